@@ -2,8 +2,19 @@
 
 #include "diana.hpp"
 
+#include <atomic>
+
 namespace Diana {
 
+// ============================================================================
+// TYPES
+// - one counter for the whole program so every World agrees on the indexes
+// - types first used on different threads must not share one
+unsigned int _nextTypeIndex() {
+	static std::atomic<unsigned int> next(0);
+	return next.fetch_add(1);
+}
+
 // ============================================================================
 // WORLD
 // - really 'diana' but world is a better name
@@ -11,6 +22,54 @@ World::World(void *(*malloc)(size_t), void (*free)(void *)) {
 	allocate_diana(malloc, free, &diana);
 }
 
+World::World(const struct diana_allocator & allocator) {
+	allocate_diana_withAllocator(&allocator, &diana);
+}
+
+#if DL_PMR
+// memory_resource wants the size and alignment back, they go just before the block
+// in a header as big as the alignment
+static void *_resource_alignedAlloc(void *user_data, size_t alignment, size_t size) {
+	std::pmr::memory_resource *resource = (std::pmr::memory_resource *)user_data;
+	size_t header = alignment > alignof(std::max_align_t) ? alignment : alignof(std::max_align_t);
+	unsigned char *ptr;
+	try {
+		ptr = (unsigned char *)resource->allocate(header + size, header) + header;
+	} catch(const std::bad_alloc &) {
+		return NULL;
+	}
+	((size_t *)ptr)[-1] = header;
+	((size_t *)ptr)[-2] = header + size;
+	return ptr;
+}
+
+static void *_resource_malloc(void *user_data, size_t size) {
+	return _resource_alignedAlloc(user_data, alignof(std::max_align_t), size);
+}
+
+static void _resource_free(void *user_data, void *ptr) {
+	std::pmr::memory_resource *resource = (std::pmr::memory_resource *)user_data;
+	size_t header = ((size_t *)ptr)[-1];
+	resource->deallocate((unsigned char *)ptr - header, ((size_t *)ptr)[-2], header);
+}
+
+World::World(std::pmr::memory_resource *resource) {
+	struct diana_allocator allocator;
+	allocator.malloc = _resource_malloc;
+	allocator.free = _resource_free;
+	allocator.realloc = NULL;
+	allocator.alignedAlloc = _resource_alignedAlloc;
+	allocator.userData = resource;
+	allocate_diana_withAllocator(&allocator, &diana);
+}
+#endif
+
+World::~World() {
+	if(diana != NULL) {
+		diana_free(diana);
+	}
+}
+
 void World::registerSystem(System *system) {
 	system->setWorld(this);
 }
@@ -2,42 +2,139 @@
 
 #include "../diana.h"
 
-#include <map>
+#include <vector>
 #include <typeinfo>
 #include <string>
+#include <utility>
+#include <type_traits>
+#include <new>
 #include <cstdlib>
 
+// World constructor taking a std::pmr::memory_resource
+#ifndef DL_PMR
+#if __cplusplus >= 201703L
+#define DL_PMR 1
+#else
+#define DL_PMR 0
+#endif
+#endif
+
+#if DL_PMR
+#include <memory_resource>
+#endif
+
 namespace Diana {
 
+// components hide componentFlags to be stored differently
 class Component {
 public:
-	virtual unsigned int componentFlags() const { return DL_COMPONENT_FLAG_INLINE; }
+	static unsigned int componentFlags() { return DL_COMPONENT_FLAG_INLINE; }
 };
 
 class Entity;
 class System;
 class Manager;
 
+// every type used as a component gets a small index, the first time it is asked for,
+// which indexes each World's table of component ids
+unsigned int _nextTypeIndex();
+
+template<class T>
+unsigned int _typeIndex() {
+	static const unsigned int index = _nextTypeIndex();
+	return index;
+}
+
+// lifecycle hooks for components that are not trivially copyable
+template<class T>
+inline int _constructDefault(void *data, std::true_type) { new(data) T(); return DL_ERROR_NONE; }
+
+// without a default constructor there is nothing to make, the set fails
+template<class T>
+inline int _constructDefault(void *data, std::false_type) { return DL_ERROR_INVALID_VALUE; }
+
+template<class T>
+int _componentConstruct(struct diana *, void *, void *data, const void *from) {
+	if(from != NULL) {
+		new(data) T(*(const T *)from);
+		return DL_ERROR_NONE;
+	}
+	return _constructDefault<T>(data, std::is_default_constructible<T>());
+}
+
+template<class T>
+void _componentDestruct(struct diana *, void *, void *data) {
+	((T *)data)->~T();
+}
+
+template<class T>
+void _componentMove(struct diana *, void *, void *to, void *from) {
+	new(to) T(std::move(*(T *)from));
+	((T *)from)->~T();
+}
+
+// one component of an entity found by World::each
+template<class T>
+inline T *_viewComponent(struct diana *diana, const struct diana_componentStorage & storage, unsigned int component, unsigned char *row, unsigned int entity) {
+	if(storage.direct) {
+		if(storage.flags & DL_COMPONENT_INDEXED_BIT) {
+			return (T *)storage.slots[*(unsigned int *)(row + storage.offset)];
+		}
+		return (T *)(row + storage.offset);
+	}
+	T * ptr = NULL;
+	diana_getComponent(diana, entity, component, (void **)&ptr);
+	return ptr;
+}
+
 class World {
 public:
-	World(void *(*malloc)(size_t) = malloc, void (*free)(void *) = free);
+	World(void *(*malloc)(size_t) = ::malloc, void (*free)(void *) = ::free);
+	World(const struct diana_allocator & allocator);
+#if DL_PMR
+	// the resource has to outlive the world
+	World(std::pmr::memory_resource *resource);
+#endif
+	~World();
+
+	World(const World &) = delete;
+	World & operator=(const World &) = delete;
 
 	template<class T>
 	unsigned int registerComponent() {
-		const std::type_info * tid = &typeid(T);
-		if(components.count(tid) == 0) {
-			T x;
-			components[tid] = 0;
-			diana_createComponent(diana, tid->name(), sizeof(T), x.componentFlags(), &components[tid]);
+		unsigned int index = _typeIndex<T>();
+		if(index >= components.size()) {
+			components.resize(index + 1, ~0u);
+		}
+		if(components[index] == ~0u) {
+			diana_createComponent(diana, typeid(T).name(), sizeof(T), T::componentFlags(), &components[index]);
+			diana_componentAlignment(diana, components[index], alignof(T));
+			if(!std::is_trivially_copyable<T>::value) {
+				diana_componentLifecycle(diana, components[index], _componentConstruct<T>, _componentDestruct<T>, _componentMove<T>, NULL);
+			}
 		}
-		return components[tid];
+		return components[index];
 	}
 
+	// ~0u for types never registered, diana rejects it
 	template<class T>
-	unsigned int getComponentId() {
-		const std::type_info * tid = &typeid(T);
+	unsigned int getComponentId() const {
+		unsigned int index = _typeIndex<T>();
+		return index < components.size() ? components[index] : ~0u;
+	}
+
+	// calls f(T &...) for every active entity that has all of the components
+	// - the layout is looked up once, so f may change component values and
+	//   signal entities but must not spawn, clone, add or remove components
+	template<class ... T, class F>
+	void each(F f) {
+		_each<false, T...>(f, std::index_sequence_for<T...>());
+	}
 
-		return components[tid];
+	// same as each, calling f(Entity, T &...)
+	template<class ... T, class F>
+	void eachEntity(F f) {
+		_each<true, T...>(f, std::index_sequence_for<T...>());
 	}
 
 	void registerSystem(System *system);
@@ -52,8 +149,17 @@ public:
 	struct diana *getDiana() { return diana; }
 
 private:
+	template<bool WithEntity, class ... T, class F, size_t ... I>
+	void _each(F & f, std::index_sequence<I...>);
+
+	template<class F, class ... A>
+	static void _call(F & f, std::false_type, Entity &, A & ... a) { f(a...); }
+
+	template<class F, class ... A>
+	static void _call(F & f, std::true_type, Entity & entity, A & ... a) { f(entity, a...); }
+
 	struct diana *diana;
-	std::map<const std::type_info *, unsigned int> components;
+	std::vector<unsigned int> components;
 };
 
 class Entity {
@@ -71,10 +177,21 @@ public:
 		setComponent(&data);
 	}
 
+	// constructs the component in its slot, appending for multiple components
+	template<class T, class ... A>
+	T *emplace(A && ... args) {
+		unsigned int cid = _world->getComponentId<T>();
+		void * ptr = NULL;
+		if(diana_emplaceComponent(_world->getDiana(), _id, cid, &ptr) != DL_ERROR_NONE) {
+			return NULL;
+		}
+		return new(ptr) T(std::forward<A>(args)...);
+	}
+
 	template<class T>
 	T *getComponent() {
 		unsigned int cid = _world->getComponentId<T>();
-		T * ptr;
+		T * ptr = NULL;
 		diana_getComponent(_world->getDiana(), _id, cid, (void **)&ptr);
 		return ptr;
 	}
@@ -91,6 +208,48 @@ private:
 	unsigned int _id;
 };
 
+template<bool WithEntity, class ... T, class F, size_t ... I>
+void World::_each(F & f, std::index_sequence<I...>) {
+	const unsigned int ids[] = { getComponentId<T>()... };
+	struct diana_componentStorage storages[sizeof...(T)];
+	struct diana_storage storage;
+	unsigned int n, entity;
+
+	if(diana_getStorage(diana, &storage) != DL_ERROR_NONE) {
+		return;
+	}
+	for(size_t i = 0; i < sizeof...(T); i++) {
+		if(diana_getComponentStorage(diana, ids[i], &storages[i]) != DL_ERROR_NONE) {
+			return;
+		}
+	}
+
+	n = storage.numRows < storage.activeCapacity ? storage.numRows : storage.activeCapacity;
+	for(entity = 0; entity < n; entity++) {
+		if(storage.active[entity >> 3] == 0) {
+			entity |= 7;
+			continue;
+		}
+		if(!(storage.active[entity >> 3] & (1 << (entity & 7)))) {
+			continue;
+		}
+
+		const unsigned int *signature = storage.signatures + (size_t)entity * storage.signatureWords;
+		bool all = true;
+		for(size_t i = 0; i < sizeof...(T); i++) {
+			all = all && (signature[ids[i] / DL_SIGNATURE_BITS] & (1u << (ids[i] % DL_SIGNATURE_BITS)));
+		}
+		if(!all) {
+			continue;
+		}
+
+		unsigned char *row = storage.rows + (size_t)entity * storage.rowSize;
+
+		Entity e(this, entity);
+		_call(f, std::integral_constant<bool, WithEntity>(), e, *_viewComponent<T>(diana, storages[I], ids[I], row, entity)...);
+	}
+}
+
 class System {
 public:
 	System(const char *name) : _name(name) { }
@@ -127,6 +286,79 @@ private:
 	unsigned int _id;
 };
 
+// position of U in T...
+template<class U, class ... T> struct _indexOf;
+template<class U, class ... T> struct _indexOf<U, U, T...> : std::integral_constant<size_t, 0> { };
+template<class U, class V, class ... T> struct _indexOf<U, V, T...> : std::integral_constant<size_t, 1 + _indexOf<U, T...>::value> { };
+
+// up to DL_BATCH_SIZE entities of a BatchSystem, with the layout of their components looked up once
+template<class ... T>
+class Batch {
+public:
+	Batch(World *world, const unsigned int *entities, unsigned int count) : _world(world), _entities(entities), _count(count), _ids{ world->getComponentId<T>()... } {
+		diana_getStorage(world->getDiana(), &_storage);
+		for(size_t i = 0; i < sizeof...(T); i++) {
+			diana_getComponentStorage(world->getDiana(), _ids[i], &_components[i]);
+		}
+	}
+
+	unsigned int size() const { return _count; }
+	unsigned int id(unsigned int i) const { return _entities[i]; }
+	Entity entity(unsigned int i) const { return Entity(_world, _entities[i]); }
+
+	template<class U>
+	U & get(unsigned int i) const {
+		const size_t I = _indexOf<U, T...>::value;
+		return *_viewComponent<U>(_world->getDiana(), _components[I], _ids[I], _storage.rows + _entities[i] * _storage.rowSize, _entities[i]);
+	}
+
+	// calls f(T &...) for every entity of the batch
+	template<class F>
+	void each(F f) const {
+		_each(f, std::index_sequence_for<T...>());
+	}
+
+private:
+	template<class F, size_t ... I>
+	void _each(F & f, std::index_sequence<I...>) const {
+		for(unsigned int i = 0; i < _count; i++) {
+			unsigned char *row = _storage.rows + _entities[i] * _storage.rowSize;
+			f(*_viewComponent<T>(_world->getDiana(), _components[I], _ids[I], row, _entities[i])...);
+		}
+	}
+
+	World * _world;
+	const unsigned int * _entities;
+	unsigned int _count;
+	unsigned int _ids[sizeof...(T)];
+	struct diana_storage _storage;
+	struct diana_componentStorage _components[sizeof...(T)];
+};
+
+// a system watching T... whose entities go to Derived::processBatch(Batch<T...> &, float)
+// - called without a virtual call or an Entity per entity, Derived hides processBatch
+// - overriding addWatches has to call BatchSystem::addWatches
+template<class Derived, class ... T>
+class BatchSystem : public System {
+public:
+	BatchSystem(const char *name) : System(name) { }
+
+	virtual void addWatches() {
+		int watches[] = { 0, (watch<T>(), 0)... };
+		(void)watches;
+		diana_systemBatch(getWorld()->getDiana(), getId(), _batch);
+	}
+
+	void processBatch(Batch<T...> & batch, float delta) { }
+
+private:
+	static void _batch(struct diana *, void *user_data, const unsigned int *entities, unsigned int count, float delta) {
+		Derived *sys = static_cast<Derived *>((System *)user_data);
+		Batch<T...> batch(sys->getWorld(), entities, count);
+		sys->processBatch(batch, delta);
+	}
+};
+
 class Manager {
 public:
 	Manager(const char *name) : _name(name) { }
@@ -4,11 +4,150 @@
 
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+
+#if DL_STATS || DL_TRACE
+#include <time.h>
+#endif
+
+#if DL_TRACE || DL_RECORD
+#include <stdio.h>
+#endif
+
+#if DL_PERF && defined(__linux__)
+#define DL_PERF_EVENT 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#define DL_PERF_EVENT 0
+#endif
+
+// reserved address space for the entity table, 0 leaves mmap out
+#ifndef DL_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define DL_MMAP 1
+#else
+#define DL_MMAP 0
+#endif
+#endif
+
+#if DL_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// every world reserves address space, so no row is ever outside the table and
+// finding one skips the check for rows spawned while processing
+#ifndef DL_RESERVED_ONLY
+#define DL_RESERVED_ONLY 0
+#endif
+
+#if DL_RESERVED_ONLY && !DL_MMAP
+#error DL_RESERVED_ONLY needs DL_MMAP
+#endif
+
+// what malloc is trusted to align to, more goes through _alignedMalloc
+#ifndef DL_MALLOC_ALIGNMENT
+#define DL_MALLOC_ALIGNMENT (2 * sizeof(void *))
+#endif
+
+// bytes of slots of indexed components allocated at once
+#ifndef DL_SLAB_SIZE
+#define DL_SLAB_SIZE 4096
+#endif
+
+// lay rows out so components systems watch together sit next to each other, hot
+// ones first. 0 keeps the order components were created in
+#ifndef DL_LAYOUT_WATCHED
+#define DL_LAYOUT_WATCHED 1
+#endif
+
+// adaptive components move into the row once more than DL_ADAPTIVE_INLINE percent of
+// the live entities have them and out of it below DL_ADAPTIVE_INDEXED percent,
+// looked at every DL_ADAPTIVE_FRAMES calls to diana_process
+#ifndef DL_ADAPTIVE_INLINE
+#define DL_ADAPTIVE_INLINE 50
+#endif
+
+#ifndef DL_ADAPTIVE_INDEXED
+#define DL_ADAPTIVE_INDEXED 10
+#endif
+
+#ifndef DL_ADAPTIVE_FRAMES
+#define DL_ADAPTIVE_FRAMES 64
+#endif
+
+// bytes in a page of the sparse side of a _sparseIntegerSet
+#ifndef DL_SPARSE_PAGE_SIZE
+#define DL_SPARSE_PAGE_SIZE 4096
+#endif
+
+#define DL_ALIGN(X, A) (((X) + (A) - 1) & ~((size_t)(A) - 1))
+
+// tables grow by half again, capped where an unsigned int would wrap
+#define DL_GROW(X) ((X) < UINT_MAX / 3 * 2 ? (X) + ((X) >> 1) : UINT_MAX)
 
 static int _malloc(struct diana *diana, size_t size, void ** r);
 static int _realloc(struct diana *diana, void *ptr, size_t oldSize, size_t newSize, void ** r);
 static int _free(struct diana *diana, void *ptr);
 
+// ============================================================================
+// BUFFER
+// - growable byte buffer, used to serialize deltas and checkpoints
+// - keeps its capacity when reset so it can be reused
+struct _buffer {
+	unsigned char *data;
+	size_t size;
+	size_t capacity;
+};
+
+static int _buffer_write(struct diana *diana, struct _buffer *b, const void *data, size_t size) {
+	if(size == 0) {
+		return DL_ERROR_NONE;
+	}
+	if(size > (size_t)-1 - b->size) {
+		return DL_ERROR_OUT_OF_MEMORY;
+	}
+	if(b->size + size > b->capacity) {
+		size_t newCapacity = b->size + size;
+		newCapacity += newCapacity >> 1 < (size_t)-1 - newCapacity ? newCapacity >> 1 : 0;
+		int err = _realloc(diana, b->data, b->capacity, newCapacity, (void **)&b->data);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+		b->capacity = newCapacity;
+	}
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+	return DL_ERROR_NONE;
+}
+
+struct _reader {
+	const unsigned char *data;
+	size_t size;
+	size_t position;
+};
+
+static int _reader_read(struct _reader *r, const void ** ptr, size_t size) {
+	if(r->size - r->position < size) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+	*ptr = r->data + r->position;
+	r->position += size;
+	return DL_ERROR_NONE;
+}
+
+static int _reader_readUInt(struct _reader *r, unsigned int *value) {
+	const void *ptr;
+	int err = _reader_read(r, &ptr, sizeof(*value));
+	if(err == DL_ERROR_NONE) {
+		memcpy(value, ptr, sizeof(*value));
+	}
+	return err;
+}
+
 /* UNUSED
 // ============================================================================
 // VECTOR
@@ -33,7 +172,7 @@ void _vector_init(struct diana *diana, struct _vector *v, size_t size, unsigned
 void _vector_push(struct diana *diana, struct _vector *v, void *data) {
 	unsigned int length = ++v->length;
 	if(length > v->capacity) {
-		_vector_reserve(diana, v, (length + 1) * 1.5);
+		_vector_reserve(diana, v, DL_GROW(length + 1));
 	}
 	if(data != NULL) {
 		memcpy((unsigned char *)v->data + v->length * v->size, data, v->size);
@@ -59,35 +198,160 @@ int _vector_pop(struct diana *diana, struct _vector *v, void *r) {
 // - and iterating over
 // - used for delaying entity adding, enabling, disabled and deleting
 // - used by each system to track entities it has
+// - the sparse side is paged, pages are only made where elements go, and the dense
+//   side grows with the population, so a few large ids cost a few pages. the first
+//   page grows up to a full one, so sets of small ids stay small
 struct _sparseIntegerSet {
 	unsigned int *dense;
-	unsigned int *sparse;
+	unsigned int **pages;
 	unsigned int population;
 	unsigned int capacity;
+	unsigned int numPages;
+	unsigned int firstPage;
 };
 
-/* UNUSED
+#define DL_SPARSE_PAGE (DL_SPARSE_PAGE_SIZE / sizeof(unsigned int))
+
+static unsigned int *_sparseIntegerSet_slot(struct _sparseIntegerSet *is, unsigned int i) {
+	unsigned int page = i / DL_SPARSE_PAGE;
+	if(page >= is->numPages || is->pages[page] == NULL || (page == 0 && i >= is->firstPage)) {
+		return NULL;
+	}
+	return is->pages[page] + i % DL_SPARSE_PAGE;
+}
+
 static int _sparseIntegerSet_contains(struct diana *diana, struct _sparseIntegerSet *is, unsigned int i) {
-	if(i >= is->capacity) {
+	unsigned int *slot = _sparseIntegerSet_slot(is, i);
+	if(slot == NULL) {
 		return 0;
 	}
-	unsigned int a = is->sparse[i];
+	unsigned int a = *slot;
 	unsigned int n = is->population;
 	return a < n && is->dense[a] == i;
 }
-*/
+
+// make room for the pages of ids below capacity, the pages themselves come with their first element
+static int _sparseIntegerSet_reserve(struct diana *diana, struct _sparseIntegerSet *is, unsigned int capacity) {
+	unsigned int numPages = (capacity + DL_SPARSE_PAGE - 1) / DL_SPARSE_PAGE;
+	int err;
+	if(numPages <= is->numPages) {
+		return DL_ERROR_NONE;
+	}
+	if((err = _realloc(diana, is->pages, is->numPages * sizeof(unsigned int *), numPages * sizeof(unsigned int *), (void **)&is->pages)) != DL_ERROR_NONE) {
+		return err;
+	}
+	is->numPages = numPages;
+	return DL_ERROR_NONE;
+}
+
+// make the pages and dense room for ids below capacity up front, so inserting them never allocates
+static int _sparseIntegerSet_commit(struct diana *diana, struct _sparseIntegerSet *is, unsigned int capacity) {
+	unsigned int page, numPages = (capacity + DL_SPARSE_PAGE - 1) / DL_SPARSE_PAGE;
+	int err;
+
+	if((err = _sparseIntegerSet_reserve(diana, is, capacity)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	if(numPages > 0 && is->firstPage < DL_SPARSE_PAGE && is->firstPage < capacity) {
+		unsigned int firstPage = capacity < DL_SPARSE_PAGE ? capacity : DL_SPARSE_PAGE;
+		if((err = _realloc(diana, is->pages[0], is->firstPage * sizeof(unsigned int), firstPage * sizeof(unsigned int), (void **)&is->pages[0])) != DL_ERROR_NONE) {
+			return err;
+		}
+		is->firstPage = firstPage;
+	}
+	for(page = 1; page < numPages; page++) {
+		if(is->pages[page] == NULL && (err = _malloc(diana, DL_SPARSE_PAGE_SIZE, (void **)&is->pages[page])) != DL_ERROR_NONE) {
+			return err;
+		}
+	}
+
+	if(capacity > is->capacity) {
+		if((err = _realloc(diana, is->dense, is->capacity * sizeof(unsigned int), capacity * sizeof(unsigned int), (void **)&is->dense)) != DL_ERROR_NONE) {
+			return err;
+		}
+		is->capacity = capacity;
+	}
+
+	return DL_ERROR_NONE;
+}
+
+// every element has to be below capacity. pages no element is on are given back
+// and dense is cut down to the population
+static int _sparseIntegerSet_shrink(struct diana *diana, struct _sparseIntegerSet *is, unsigned int capacity) {
+	unsigned int numPages = (capacity + DL_SPARSE_PAGE - 1) / DL_SPARSE_PAGE, page, j;
+	int err;
+
+	for(page = 0; page < is->numPages; page++) {
+		unsigned int *p = is->pages[page];
+		if(p == NULL) {
+			continue;
+		}
+		if(page < numPages) {
+			unsigned int n = page == 0 ? is->firstPage : DL_SPARSE_PAGE;
+			for(j = 0; j < n; j++) {
+				if(p[j] < is->population && is->dense[p[j]] == page * DL_SPARSE_PAGE + j) {
+					break;
+				}
+			}
+			if(j < n) {
+				continue;
+			}
+		}
+		_free(diana, p);
+		is->pages[page] = NULL;
+		if(page == 0) {
+			is->firstPage = 0;
+		}
+	}
+
+	if(numPages < is->numPages) {
+		if((err = _realloc(diana, is->pages, is->numPages * sizeof(unsigned int *), numPages * sizeof(unsigned int *), (void **)&is->pages)) != DL_ERROR_NONE) {
+			return err;
+		}
+		is->numPages = numPages;
+	}
+
+	if(is->population < is->capacity) {
+		if((err = _realloc(diana, is->dense, is->capacity * sizeof(unsigned int), is->population * sizeof(unsigned int), (void **)&is->dense)) != DL_ERROR_NONE) {
+			return err;
+		}
+		is->capacity = is->population;
+	}
+
+	return DL_ERROR_NONE;
+}
 
 static int _sparseIntegerSet_insert(struct diana *diana, struct _sparseIntegerSet *is, unsigned int i) {
-	if(i >= is->capacity) {
-		unsigned int newCapacity = (i + 1) * 1.5;
-		_realloc(diana, is->dense, is->capacity * sizeof(unsigned int), newCapacity * sizeof(unsigned int), (void **)&is->dense);
-		_realloc(diana, is->sparse, is->capacity * sizeof(unsigned int), newCapacity * sizeof(unsigned int), (void **)&is->sparse);
-		is->capacity = newCapacity;
+	unsigned int page = i / DL_SPARSE_PAGE, *slot;
+
+	if(page >= is->numPages && _sparseIntegerSet_reserve(diana, is, DL_GROW(i + 1)) != DL_ERROR_NONE) {
+		return 1;
+	}
+	if(page == 0) {
+		if(i >= is->firstPage) {
+			unsigned int firstPage = DL_GROW(i + 1) < DL_SPARSE_PAGE ? DL_GROW(i + 1) : DL_SPARSE_PAGE;
+			if(_realloc(diana, is->pages[0], is->firstPage * sizeof(unsigned int), firstPage * sizeof(unsigned int), (void **)&is->pages[0]) != DL_ERROR_NONE) {
+				return 1;
+			}
+			is->firstPage = firstPage;
+		}
+	} else if(is->pages[page] == NULL && _malloc(diana, DL_SPARSE_PAGE_SIZE, (void **)&is->pages[page]) != DL_ERROR_NONE) {
+		return 1;
 	}
-	unsigned int a = is->sparse[i];
+	slot = is->pages[page] + i % DL_SPARSE_PAGE;
+
+	unsigned int a = *slot;
 	unsigned int n = is->population;
 	if(a >= n || is->dense[a] != i) {
-		is->sparse[i] = n;
+		if(n >= is->capacity) {
+			unsigned int capacity = DL_GROW(n + 1);
+			if(_realloc(diana, is->dense, is->capacity * sizeof(unsigned int), capacity * sizeof(unsigned int), (void **)&is->dense) != DL_ERROR_NONE) {
+				return 1;
+			}
+			is->capacity = capacity;
+		}
+		*slot = n;
 		is->dense[n] = i;
 		is->population = n + 1;
 		return 0;
@@ -96,16 +360,17 @@ static int _sparseIntegerSet_insert(struct diana *diana, struct _sparseIntegerSe
 }
 
 static int _sparseIntegerSet_delete(struct diana *diana, struct _sparseIntegerSet *is, unsigned int i) {
-	if(i >= is->capacity || is->population == 0) {
+	unsigned int *slot = _sparseIntegerSet_slot(is, i);
+	if(slot == NULL || is->population == 0) {
 		return 0;
 	}
-	unsigned int a = is->sparse[i];
+	unsigned int a = *slot;
 	unsigned int n = is->population - 1;
-	if(a <= n || is->dense[a] == i) {
+	if(a <= n && is->dense[a] == i) {
 		unsigned int e = is->dense[n];
 		is->population = n;
-		is->dense[n] = e;
-		is->sparse[e] = a;
+		is->dense[a] = e;
+		*_sparseIntegerSet_slot(is, e) = a;
 		return 1;
 	}
 	return 0;
@@ -127,11 +392,75 @@ static unsigned int _sparseIntegerSet_pop(struct diana *diana, struct _sparseInt
 }
 
 static void _sparseIntegerSet_free(struct diana *diana, struct _sparseIntegerSet *is) {
+	unsigned int page;
+	for(page = 0; page < is->numPages; page++) {
+		_free(diana, is->pages[page]);
+	}
+	_free(diana, is->pages);
 	_free(diana, is->dense);
-	_free(diana, is->sparse);
 	memset(is, 0, sizeof(*is));
 }
 
+static size_t _sparseIntegerSet_bytes(struct _sparseIntegerSet *is) {
+	size_t bytes = sizeof(unsigned int) * is->capacity + sizeof(unsigned int *) * is->numPages;
+	unsigned int page;
+	for(page = 1; page < is->numPages; page++) {
+		bytes += is->pages[page] != NULL ? DL_SPARSE_PAGE_SIZE : 0;
+	}
+	bytes += sizeof(unsigned int) * is->firstPage;
+	return bytes;
+}
+
+static int _sparseIntegerSet_save(struct diana *diana, struct _sparseIntegerSet *is, struct _buffer *b) {
+	int err = _buffer_write(diana, b, &is->population, sizeof(is->population));
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+	return _buffer_write(diana, b, is->dense, sizeof(unsigned int) * is->population);
+}
+
+// make room for what restore is about to put in, and at least capacity, so it can not fail
+static int _sparseIntegerSet_prepareRestore(struct diana *diana, struct _sparseIntegerSet *is, struct _reader *r, unsigned int capacity) {
+	unsigned int population, i, e;
+	const unsigned char *dense;
+	int err;
+
+	if((err = _reader_readUInt(r, &population)) != DL_ERROR_NONE ||
+	   (err = _reader_read(r, (const void **)&dense, sizeof(unsigned int) * population)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	for(i = 0; i < population; i++) {
+		memcpy(&e, dense + sizeof(unsigned int) * i, sizeof(e));
+		if(e == UINT_MAX) {
+			return DL_ERROR_INVALID_VALUE;
+		}
+		capacity = e + 1 > capacity ? e + 1 : capacity;
+	}
+
+	return _sparseIntegerSet_commit(diana, is, capacity);
+}
+
+// restores the same order, so pops come out the same after a rollback
+static int _sparseIntegerSet_restore(struct diana *diana, struct _sparseIntegerSet *is, struct _reader *r) {
+	unsigned int population, i, e;
+	const unsigned char *dense;
+	int err;
+
+	if((err = _reader_readUInt(r, &population)) != DL_ERROR_NONE ||
+	   (err = _reader_read(r, (const void **)&dense, sizeof(unsigned int) * population)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	_sparseIntegerSet_clear(diana, is);
+	for(i = 0; i < population; i++) {
+		memcpy(&e, dense + sizeof(unsigned int) * i, sizeof(e));
+		_sparseIntegerSet_insert(diana, is, e);
+	}
+
+	return DL_ERROR_NONE;
+}
+
 // ============================================================================
 // DENSE INTEGER SET
 // - more memory effecient
@@ -153,6 +482,53 @@ static int _bits_clear(unsigned char *bytes, unsigned int bit) {
 	return r;
 }
 
+// ============================================================================
+// SIGNATURE
+// - the components an entity has, a bit each, in words kept apart from the rows
+// - a scan over many entities only reads their signatures
+// - matching goes a word at a time without branches, so compilers vectorize it
+static int _signature_set(unsigned int *words, unsigned int bit) {
+	unsigned int mask = 1u << (bit % DL_SIGNATURE_BITS);
+	int r = !!(words[bit / DL_SIGNATURE_BITS] & mask);
+	words[bit / DL_SIGNATURE_BITS] |= mask;
+	return r;
+}
+
+static int _signature_isSet(const unsigned int *words, unsigned int bit) {
+	return !!(words[bit / DL_SIGNATURE_BITS] & (1u << (bit % DL_SIGNATURE_BITS)));
+}
+
+static int _signature_clear(unsigned int *words, unsigned int bit) {
+	unsigned int mask = 1u << (bit % DL_SIGNATURE_BITS);
+	int r = !!(words[bit / DL_SIGNATURE_BITS] & mask);
+	words[bit / DL_SIGNATURE_BITS] &= ~mask;
+	return r;
+}
+
+// every bit of want is set and none of avoid
+static int _signature_matches(const unsigned int *words, const unsigned int *want, const unsigned int *avoid, unsigned int n) {
+	unsigned int miss = 0, i;
+
+	for(i = 0; i < n; i++) {
+		miss |= (words[i] & want[i]) ^ want[i];
+		miss |= words[i] & avoid[i];
+	}
+
+	return miss == 0;
+}
+
+// of a word with a bit set
+static unsigned int _signature_lowest(unsigned int word) {
+	unsigned int bit = 0;
+
+	while(!(word & 1)) {
+		word >>= 1;
+		bit++;
+	}
+
+	return bit;
+}
+
 // ============================================================================
 
 struct _denseIntegerSet {
@@ -160,17 +536,45 @@ struct _denseIntegerSet {
 	unsigned int capacity;
 };
 
-/* UNUSED
+#if DL_DELTA
 static int _denseIntegerSet_contains(struct diana *diana, struct _denseIntegerSet *is, unsigned int i) {
 	return i < is->capacity && _bits_isSet(is->bytes, i);
 }
-*/
+#endif
+
+static int _denseIntegerSet_reserve(struct diana *diana, struct _denseIntegerSet *is, unsigned int capacity) {
+	int err;
+	if(capacity <= is->capacity) {
+		return DL_ERROR_NONE;
+	}
+	err = _realloc(diana, is->bytes, (is->capacity + 7) >> 3, (capacity + 7) >> 3, (void **)&is->bytes);
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+	is->capacity = capacity;
+	return DL_ERROR_NONE;
+}
+
+// bits past capacity are dropped
+static int _denseIntegerSet_shrink(struct diana *diana, struct _denseIntegerSet *is, unsigned int capacity) {
+	int err;
+	if(capacity >= is->capacity) {
+		return DL_ERROR_NONE;
+	}
+	err = _realloc(diana, is->bytes, (is->capacity + 7) >> 3, (capacity + 7) >> 3, (void **)&is->bytes);
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+	if(capacity & 7) {
+		is->bytes[capacity >> 3] &= (1 << (capacity & 7)) - 1;
+	}
+	is->capacity = capacity;
+	return DL_ERROR_NONE;
+}
 
 static unsigned int _denseIntegerSet_insert(struct diana *diana, struct _denseIntegerSet *is, unsigned int i) {
-	if(i >= is->capacity) {
-		unsigned int newCapacity = (i + 1) * 1.5;
-		_realloc(diana, is->bytes, (is->capacity + 7) >> 3, (newCapacity + 7) >> 3, (void **)&is->bytes);
-		is->capacity = newCapacity;
+	if(i >= is->capacity && _denseIntegerSet_reserve(diana, is, DL_GROW(i + 1)) != DL_ERROR_NONE) {
+		return 0;
 	}
 	return _bits_set(is->bytes, i);
 }
@@ -203,10 +607,63 @@ static void _denseIntegerSet_free(struct diana *diana, struct _denseIntegerSet *
 	memset(is, 0, sizeof(*is));
 }
 
+static size_t _denseIntegerSet_bytes(struct _denseIntegerSet *is) {
+	return (is->capacity + 7) >> 3;
+}
+
+static int _denseIntegerSet_save(struct diana *diana, struct _denseIntegerSet *is, struct _buffer *b) {
+	int err = _buffer_write(diana, b, &is->capacity, sizeof(is->capacity));
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+	return _buffer_write(diana, b, is->bytes, (is->capacity + 7) >> 3);
+}
+
+static int _denseIntegerSet_prepareRestore(struct diana *diana, struct _denseIntegerSet *is, struct _reader *r) {
+	unsigned int capacity;
+	const void *bytes;
+	int err;
+
+	if((err = _reader_readUInt(r, &capacity)) != DL_ERROR_NONE ||
+	   (err = _reader_read(r, &bytes, (capacity + 7) >> 3)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	return _denseIntegerSet_reserve(diana, is, capacity);
+}
+
+static int _denseIntegerSet_restore(struct diana *diana, struct _denseIntegerSet *is, struct _reader *r) {
+	unsigned int capacity;
+	const void *bytes;
+	int err;
+
+	if((err = _reader_readUInt(r, &capacity)) != DL_ERROR_NONE ||
+	   (err = _reader_read(r, &bytes, (capacity + 7) >> 3)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	if(capacity > is->capacity) {
+		err = _realloc(diana, is->bytes, (is->capacity + 7) >> 3, (capacity + 7) >> 3, (void **)&is->bytes);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+		is->capacity = capacity;
+	}
+
+	if(is->bytes != NULL) {
+		memset(is->bytes, 0, (is->capacity + 7) >> 3);
+		memcpy(is->bytes, bytes, (capacity + 7) >> 3);
+	}
+
+	return DL_ERROR_NONE;
+}
+
 // ============================================================================
 // PRIMARY DATA
 struct _componentBag {
 	unsigned int count;
+	// indexes is kept when the bag empties so the row can reuse it
+	unsigned int capacity;
 	unsigned int *indexes;
 };
 
@@ -216,9 +673,34 @@ struct _component {
 	size_t offset;
 	unsigned int flags;
 
+	size_t alignment;
+
+	// data[i] points at slot i, slots are cut out of aligned slabs of slabSlots each
 	void **data;
+	unsigned int dataCapacity;
 	struct _sparseIntegerSet freeDataIndexes;
 	unsigned int nextDataIndex;
+	size_t stride;
+	unsigned int slabSlots;
+	void **slabs;
+	unsigned int numSlabs;
+	unsigned int slabCapacity;
+
+	// a defragmentation pass walks entities in order and moves their slots to
+	// defragSlot on, owners[slot] is the entity using a slot while one runs
+	unsigned int *owners;
+	unsigned int defragEntity;
+	unsigned int defragSlot;
+	void *defragScratch;
+
+	// an adaptive component picked to move into the row or out of it
+	unsigned char migrate;
+
+	// lifecycle, without hooks data is copied with memcpy
+	int (*construct)(struct diana *, void *, void *data, const void *from);
+	void (*destruct)(struct diana *, void *, void *data);
+	void (*move)(struct diana *, void *, void *to, void *from);
+	void *lifecycleUserData;
 
 #if DL_COMPUTE
 	void (*compute)(struct diana *, void *, unsigned int entity, unsigned int index, void *);
@@ -226,34 +708,62 @@ struct _component {
 
 	struct _sparseIntegerSet componentsToDirty;
 #endif
+
+#if DL_DELTA
+	// entities this component changed on since the last delta
+	struct _denseIntegerSet deltaChanged;
+#endif
 };
 
+static void _alignedFree(struct diana *diana, size_t alignment, void *ptr);
+
 static void _component_free(struct diana *diana, struct _component *component) {
 	unsigned int i = 0;
 	_free(diana, (void *)component->name);
-	for(i = 0; i < component->nextDataIndex; i++) {
-		_free(diana, component->data[i]);
+	for(i = 0; i < component->numSlabs; i++) {
+		_alignedFree(diana, component->alignment, component->slabs[i]);
 	}
+	_free(diana, component->slabs);
 	_free(diana, component->data);
+	_free(diana, component->owners);
+	_alignedFree(diana, component->alignment, component->defragScratch);
 	_sparseIntegerSet_free(diana, &component->freeDataIndexes);
 #if DL_COMPUTE
 	_sparseIntegerSet_free(diana, &component->componentsToDirty);
+#endif
+#if DL_DELTA
+	_denseIntegerSet_free(diana, &component->deltaChanged);
 #endif
 	memset(component, 0, sizeof(*component));
 }
 
+static void _endDefragment(struct diana *diana, struct _component *c) {
+	_free(diana, c->owners);
+	c->owners = NULL;
+	c->defragEntity = 0;
+	c->defragSlot = 0;
+}
+
 struct _system {
 	const char *name;
 	unsigned int flags;
 	void *userData;
 	void (*starting)(struct diana *, void *user_data);
 	void (*process)(struct diana *, void *user_data, unsigned int entity, float delta);
+	void (*batch)(struct diana *, void *user_data, const unsigned int *entities, unsigned int count, float delta);
 	void (*ending)(struct diana *, void *user_data);
 	void (*subscribed)(struct diana *, void *user_data, unsigned int entity);
 	void (*unsubscribed)(struct diana *, void *user_data, unsigned int entity);
 	struct _sparseIntegerSet watch;
 	struct _sparseIntegerSet exclude;
 	struct _denseIntegerSet entities;
+
+	// watch then exclude as signatures, made when the world is initialized
+	unsigned int *match;
+
+#if DL_STATS
+	struct diana_systemStats stats;
+#endif
 };
 
 static void _system_free(struct diana *diana, struct _system *system) {
@@ -261,6 +771,7 @@ static void _system_free(struct diana *diana, struct _system *system) {
 	_sparseIntegerSet_free(diana, &system->watch);
 	_sparseIntegerSet_free(diana, &system->exclude);
 	_denseIntegerSet_free(diana, &system->entities);
+	_free(diana, system->match);
 	memset(system, 0, sizeof(*system));
 }
 
@@ -279,6 +790,27 @@ static void _manager_free(struct diana *diana, struct _manager *manager) {
 	memset(manager, 0, sizeof(*manager));
 }
 
+#if DL_TRACE
+struct _traceEvent {
+	const char *name;
+	unsigned int frame;
+	unsigned long long begin;
+	unsigned long long end;
+};
+#endif
+
+#if DL_RECORD
+#define DL_RECORD_BUFFER 4096
+#define DL_RECORD_DEPTH 32
+
+struct _recordContext {
+	unsigned int callback;
+	unsigned int id;
+	unsigned int entity;
+	int written;
+};
+#endif
+
 #if DL_COMPUTE
 struct _computingComponentStack {
 	struct _computingComponentStack *previous;
@@ -287,8 +819,11 @@ struct _computingComponentStack {
 #endif
 
 struct diana {
-	void *(*malloc)(size_t);
-	void (*free)(void *);
+	struct diana_allocator allocator;
+
+	// allocate_diana's functions, called through the allocator
+	void *(*plainMalloc)(size_t);
+	void (*plainFree)(void *);
 
 	int initialized;
 	int processing;
@@ -298,17 +833,47 @@ struct diana {
 	struct _sparseIntegerSet freeEntityIds;
 	unsigned int nextEntityId;
 
-	// entity data
-	// first 'column' is bits of components defined
-	// the rest are the components
-	unsigned int dataWidth;
+	// entity data, the components
+	size_t dataWidth;
+	size_t dataAlignment;
+#if DL_HANDLES
+	// every row starts with the generation of its id, rows past the height are
+	// dropped with theirs so fresh ids start at generationFloor
+	size_t generationOffset;
+	unsigned int generationFloor;
+#endif
 	unsigned int dataHeight;
 	unsigned int dataHeightCapacity;
 	void *data;
 
 	unsigned int processingDataHeight;
+	unsigned int processingDataCapacity;
 	void **processingData;
 
+	// the components each entity has, signatureWords per entity. they grow on their
+	// own, spawns while processing included, and past the height they are empty
+	unsigned int signatureWords;
+	unsigned int signatureCapacity;
+	unsigned int *signatures;
+
+	// with reserved address space the table grows in place by committing pages,
+	// rows never move and spawns during processing go straight into it
+	unsigned int reservedRows;
+	size_t reservedBytes;
+	size_t committedBytes;
+
+	// diana_process shrinks when capacity is over shrinkFactor times what is used, 0 never
+	unsigned int shrinkFactor;
+
+	// the component diana_defragment carries on with
+	unsigned int defragComponent;
+
+	// components that move between the row and slots, frames since they were looked
+	// at, and how many times the row was laid out again, checkpoints keep to theirs
+	unsigned int adaptiveComponents;
+	unsigned int adaptiveFrames;
+	unsigned int layouts;
+
 	// buffer entity status notifications
 	struct _sparseIntegerSet added;
 	struct _sparseIntegerSet enabled;
@@ -321,6 +886,10 @@ struct diana {
 	unsigned int num_components;
 	struct _component *components;
 
+	// components with lifecycle hooks, and inline ones of them that move with their row
+	unsigned int lifecycleComponents;
+	unsigned int movingComponents;
+
 	unsigned int num_systems;
 	struct _system *systems;
 
@@ -330,26 +899,287 @@ struct diana {
 #if DL_COMPUTE
 	struct _computingComponentStack *computingComponentStack;
 #endif
+
+#if DL_DELTA
+	// entities touched since the last delta and the signals they got
+	struct _sparseIntegerSet deltaEntities;
+	struct _sparseIntegerSet deltaAdded;
+	struct _sparseIntegerSet deltaEnabled;
+	struct _sparseIntegerSet deltaDisabled;
+	struct _sparseIntegerSet deltaDeleted;
+#endif
+
+#if DL_STATS
+	struct diana_stats stats;
+#endif
+
+#if DL_TRACE
+	// ring of finished spans, traceHead counts every span ever written
+	struct _traceEvent *traceEvents;
+	unsigned int traceCapacity;
+	unsigned int traceId;
+	unsigned int traceFrame;
+	unsigned long long traceHead;
+#endif
+
+#if DL_RECORD
+	FILE *recordFile;
+	unsigned char *recordBuffer;
+	unsigned int recordSize;
+	// callbacks diana is currently in, ENTER is written when one makes a call
+	unsigned int recordDepth;
+	struct _recordContext recordStack[DL_RECORD_DEPTH];
+	unsigned int recordCheckpoints;
+#endif
+
+#if DL_PERF_EVENT
+	// one perf_event group, -1 for counters that could not be opened
+	int perfOpened;
+	int perfLeader;
+	int perfFds[4];
+	unsigned int perfCounters;
+#endif
 };
 
 // ============================================================================
 // UTILITY
-#define FOREACH_SPARSEINTSET(I, N, S) for(N = 0, I = (S)->dense ? (S)->dense[N] : 0; N < (S)->population; N++, I = (S)->dense[N])
+#define FOREACH_SPARSEINTSET(I, N, S) for(N = 0; N < (S)->population && ((I = (S)->dense[N]), 1); N++)
 #define FOREACH_DENSEINTSET(I, D) for(I = 0; I < (D)->capacity; I++) if(_bits_isSet((D)->bytes, I))
 #define FOREACH_ARRAY(T, N, A, S) for(N = 0, T = A; N < S; N++, T++)
 
-static int _malloc(struct diana *diana, size_t size, void ** r) {
-	*r = diana->malloc(size);
-	if(*r == NULL) {
-		return DL_ERROR_OUT_OF_MEMORY;
+#if DL_STATS || DL_TRACE
+static unsigned long long _now(void) {
+	struct timespec ts;
+#if defined(CLOCK_MONOTONIC)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC);
+#endif
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#if DL_TRACE
+static unsigned long long _traceBegin(struct diana *diana) {
+	return diana->traceEvents != NULL ? _now() : 0;
+}
+
+// single writer, old spans are overwritten and nothing is allocated
+static void _trace(struct diana *diana, const char *name, unsigned long long begin) {
+	struct _traceEvent *event;
+	if(diana->traceEvents == NULL) {
+		return;
+	}
+	event = diana->traceEvents + (diana->traceHead & (diana->traceCapacity - 1));
+	event->name = name;
+	event->frame = diana->traceFrame;
+	event->begin = begin;
+	event->end = _now();
+	diana->traceHead++;
+}
+#endif
+
+#if DL_PERF_EVENT
+static const struct {
+	unsigned int bit;
+	unsigned long long config;
+} _perfEvents[4] = {
+	{ DL_PERF_CYCLES, PERF_COUNT_HW_CPU_CYCLES },
+	{ DL_PERF_INSTRUCTIONS, PERF_COUNT_HW_INSTRUCTIONS },
+	{ DL_PERF_CACHE_MISSES, PERF_COUNT_HW_CACHE_MISSES },
+	{ DL_PERF_BRANCH_MISSES, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+// counters that cannot be opened (no pmu, perf_event_paranoid, seccomp) are left out
+static void _perf_open(struct diana *diana) {
+	struct perf_event_attr attr;
+	unsigned int i;
+
+	diana->perfOpened = 1;
+	diana->perfLeader = -1;
+
+	for(i = 0; i < 4; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = _perfEvents[i].config;
+		attr.disabled = diana->perfLeader == -1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+
+		diana->perfFds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, diana->perfLeader, 0);
+		if(diana->perfFds[i] < 0) {
+			continue;
+		}
+		if(diana->perfLeader == -1) {
+			diana->perfLeader = diana->perfFds[i];
+		}
+		diana->perfCounters |= _perfEvents[i].bit;
+	}
+
+	if(diana->perfLeader != -1) {
+		ioctl(diana->perfLeader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+}
+
+static void _perf_close(struct diana *diana) {
+	unsigned int i;
+	if(diana->perfOpened) {
+		for(i = 0; i < 4; i++) {
+			if(diana->perfFds[i] >= 0) {
+				close(diana->perfFds[i]);
+			}
+		}
+	}
+	diana->perfOpened = 0;
+	diana->perfCounters = 0;
+}
+
+// one read of the whole group, values in _perfEvents order, 0 when there are no counters
+static int _perf_read(struct diana *diana, unsigned long long values[4]) {
+	unsigned long long buffer[1 + 4];
+	unsigned int i, n = 0;
+
+	if(!diana->perfOpened) {
+		_perf_open(diana);
+	}
+	if(diana->perfLeader == -1 || read(diana->perfLeader, buffer, sizeof(buffer)) <= 0) {
+		return 0;
+	}
+
+	for(i = 0; i < 4; i++) {
+		values[i] = diana->perfFds[i] >= 0 && n < buffer[0] ? buffer[1 + n++] : 0;
+	}
+
+	return 1;
+}
+#endif
+
+#if DL_RECORD
+static void _record_flush(struct diana *diana) {
+	if(diana->recordSize > 0) {
+		fwrite(diana->recordBuffer, 1, diana->recordSize, diana->recordFile);
+		diana->recordSize = 0;
+	}
+}
+
+static void _record_bytes(struct diana *diana, const void *data, size_t size) {
+	if(diana->recordSize + size > DL_RECORD_BUFFER) {
+		_record_flush(diana);
+		if(size > DL_RECORD_BUFFER) {
+			fwrite(data, 1, size, diana->recordFile);
+			return;
+		}
+	}
+	memcpy(diana->recordBuffer + diana->recordSize, data, size);
+	diana->recordSize += size;
+}
+
+static void _record_uint(struct diana *diana, size_t value) {
+	unsigned char bytes[10];
+	unsigned int n = 0;
+	do {
+		bytes[n] = value & 0x7f;
+		value >>= 7;
+		bytes[n++] |= value ? 0x80 : 0;
+	} while(value);
+	_record_bytes(diana, bytes, n);
+}
+
+static void _record_float(struct diana *diana, float value) {
+	_record_bytes(diana, &value, sizeof(value));
+}
+
+static void _record_name(struct diana *diana, const char *name) {
+	size_t length = name != NULL ? strlen(name) : 0;
+	_record_uint(diana, length);
+	_record_bytes(diana, name, length);
+}
+
+static void _record_data(struct diana *diana, unsigned int component, const void *data) {
+	// a call with a bad component fails, it gets no data
+	unsigned char present = data != NULL && component < diana->num_components;
+	_record_bytes(diana, &present, 1);
+	if(present) {
+		_record_bytes(diana, data, diana->components[component].size);
+	}
+}
+
+// start a record, returns 0 when not recording
+static int _record_op(struct diana *diana, unsigned char op) {
+	unsigned int i;
+
+	if(diana->recordFile == NULL) {
+		return 0;
+	}
+
+	for(i = 0; i < diana->recordDepth && i < DL_RECORD_DEPTH; i++) {
+		struct _recordContext *context = diana->recordStack + i;
+		if(!context->written) {
+			unsigned char enter = DL_RECORD_ENTER;
+			_record_bytes(diana, &enter, 1);
+			_record_uint(diana, context->callback);
+			_record_uint(diana, context->id);
+			_record_uint(diana, context->entity);
+			context->written = 1;
+		}
+	}
+
+	_record_bytes(diana, &op, 1);
+	return 1;
+}
+
+static void _record_enter(struct diana *diana, unsigned int callback, unsigned int id, unsigned int entity) {
+	if(diana->recordFile == NULL) {
+		return;
+	}
+	if(diana->recordDepth < DL_RECORD_DEPTH) {
+		struct _recordContext *context = diana->recordStack + diana->recordDepth;
+		context->callback = callback;
+		context->id = id;
+		context->entity = entity;
+		context->written = 0;
+	}
+	diana->recordDepth++;
+}
+
+static void _record_leave(struct diana *diana) {
+	if(diana->recordFile == NULL || diana->recordDepth == 0) {
+		return;
+	}
+	diana->recordDepth--;
+	if(diana->recordDepth < DL_RECORD_DEPTH && diana->recordStack[diana->recordDepth].written) {
+		unsigned char leave = DL_RECORD_LEAVE;
+		_record_bytes(diana, &leave, 1);
+	}
+}
+
+#define RECORD_ENTER(D, C, I, E) _record_enter(D, C, I, E)
+#define RECORD_LEAVE(D) _record_leave(D)
+#else
+#define RECORD_ENTER(D, C, I, E)
+#define RECORD_LEAVE(D)
+#endif
+
+static int _malloc(struct diana *diana, size_t size, void ** r) {
+	*r = diana->allocator.malloc(diana->allocator.userData, size);
+	if(*r == NULL) {
+		return DL_ERROR_OUT_OF_MEMORY;
 	}
+#if DL_STATS
+	diana->stats.allocations++;
+#endif
 	memset(*r, 0, size);
 	return DL_ERROR_NONE;
 }
 
 static int _free(struct diana *diana, void *ptr) {
 	if(ptr != NULL) {
-		diana->free(ptr);
+#if DL_STATS
+		diana->stats.frees++;
+#endif
+		diana->allocator.free(diana->allocator.userData, ptr);
 	}
 	return DL_ERROR_NONE;
 }
@@ -360,74 +1190,201 @@ static int _strdup(struct diana *diana, const char *s, char ** r) {
 		return DL_ERROR_NONE;
 	}
 	l = strlen(s);
-	*r = diana->malloc(l + 1);
+	*r = diana->allocator.malloc(diana->allocator.userData, l + 1);
 	if(*r == NULL) {
 		return DL_ERROR_OUT_OF_MEMORY;
 	}
+#if DL_STATS
+	diana->stats.allocations++;
+#endif
 	memcpy(*r, s, l + 1);
 	return DL_ERROR_NONE;
 }
 
+// on failure ptr and *r are left alone, so a table reallocated in place survives it
 static int _realloc(struct diana *diana, void *ptr, size_t oldSize, size_t newSize, void ** r) {
+	void *p;
 	if(oldSize == newSize) {
 		*r = ptr;
 		return DL_ERROR_NONE;
 	}
 	if(newSize == 0) {
 		_free(diana, ptr);
+		*r = NULL;
 		return DL_ERROR_NONE;
 	}
-	*r = diana->malloc(newSize);
-	if(*r == NULL) {
+	if(diana->allocator.realloc != NULL) {
+		p = diana->allocator.realloc(diana->allocator.userData, ptr, oldSize, newSize);
+		if(p == NULL) {
+			return DL_ERROR_OUT_OF_MEMORY;
+		}
+#if DL_STATS
+		diana->stats.allocations++;
+		diana->stats.frees += ptr != NULL;
+#endif
+		if(oldSize < newSize) {
+			memset((unsigned char *)p + oldSize, 0, newSize - oldSize);
+		}
+		*r = p;
+		return DL_ERROR_NONE;
+	}
+	p = diana->allocator.malloc(diana->allocator.userData, newSize);
+	if(p == NULL) {
 		return DL_ERROR_OUT_OF_MEMORY;
 	}
+#if DL_STATS
+	diana->stats.allocations++;
+#endif
 	if(oldSize < newSize) {
-		memset((unsigned char *)(*r) + oldSize, 0, newSize - oldSize);
+		memset((unsigned char *)p + oldSize, 0, newSize - oldSize);
 	}
 	if(ptr != NULL) {
-		memcpy(*r, ptr, oldSize < newSize ? oldSize : newSize);
-		diana->free(ptr);
+		memcpy(p, ptr, oldSize < newSize ? oldSize : newSize);
+		_free(diana, ptr);
+	}
+	*r = p;
+	return DL_ERROR_NONE;
+}
+
+// alignment is a power of two, without an alignedAlloc hook the block is over allocated
+// and the pointer malloc gave is kept just before the aligned one
+static int _alignedMalloc(struct diana *diana, size_t alignment, size_t size, void ** r) {
+	unsigned char *raw;
+	int err;
+
+	if(alignment <= DL_MALLOC_ALIGNMENT) {
+		return _malloc(diana, size, r);
+	}
+
+	if(diana->allocator.alignedAlloc != NULL) {
+		*r = diana->allocator.alignedAlloc(diana->allocator.userData, alignment, size);
+		if(*r == NULL) {
+			return DL_ERROR_OUT_OF_MEMORY;
+		}
+#if DL_STATS
+		diana->stats.allocations++;
+#endif
+		memset(*r, 0, size);
+		return DL_ERROR_NONE;
+	}
+
+	err = _malloc(diana, size + alignment, (void **)&raw);
+	if(err != DL_ERROR_NONE) {
+		return err;
 	}
+	*r = (void *)DL_ALIGN((size_t)raw + sizeof(void *), alignment);
+	((void **)*r)[-1] = raw;
 	return DL_ERROR_NONE;
 }
 
+static void _alignedFree(struct diana *diana, size_t alignment, void *ptr) {
+	if(ptr == NULL || alignment <= DL_MALLOC_ALIGNMENT || diana->allocator.alignedAlloc != NULL) {
+		_free(diana, ptr);
+		return;
+	}
+	_free(diana, ((void **)ptr)[-1]);
+}
+
+static void *_plainMalloc(void *userData, size_t size) {
+	return ((struct diana *)userData)->plainMalloc(size);
+}
+
+static void _plainFree(void *userData, void *ptr) {
+	((struct diana *)userData)->plainFree(ptr);
+}
+
 int allocate_diana(void *(*malloc)(size_t), void (*free)(void *), struct diana ** r) {
 	*r = malloc(sizeof(**r));
 	if(*r == NULL) {
 		return DL_ERROR_OUT_OF_MEMORY;
 	}
 	memset(*r, 0, sizeof(**r));
-	(*r)->malloc = malloc;
-	(*r)->free = free;
+	(*r)->plainMalloc = malloc;
+	(*r)->plainFree = free;
+	(*r)->allocator.malloc = _plainMalloc;
+	(*r)->allocator.free = _plainFree;
+	(*r)->allocator.userData = *r;
+	return DL_ERROR_NONE;
+}
+
+int allocate_diana_withAllocator(const struct diana_allocator *allocator, struct diana ** r) {
+	if(allocator == NULL || allocator->malloc == NULL || allocator->free == NULL) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+	*r = allocator->malloc(allocator->userData, sizeof(**r));
+	if(*r == NULL) {
+		return DL_ERROR_OUT_OF_MEMORY;
+	}
+	memset(*r, 0, sizeof(**r));
+	(*r)->allocator = *allocator;
 	return DL_ERROR_NONE;
 }
 
 static int _fixData(struct diana *diana);
+static unsigned char *_getEntityData(struct diana *diana, unsigned int entity);
+static void _removeAllComponents(struct diana *diana, unsigned int entity);
 
 int diana_free(struct diana *diana) {
 	struct _component *component;
 	struct _system *system;
 	struct _manager *manager;
 	unsigned int i, j;
+	int err;
+
+#if DL_RECORD
+	_record_op(diana, DL_RECORD_FREE);
+	diana_recordStop(diana);
+#endif
 
-	int err = _fixData(diana);
+	err = _fixData(diana);
 	if(err != DL_ERROR_NONE) {
 		return err;
 	}
 
 	for(i = 0; i < diana->nextEntityId; i++) {
-		for(j = 0; j < diana->num_components; j++) {
-			diana_removeComponents(diana, i, j);
+		_removeAllComponents(diana, i);
+	}
+
+	FOREACH_ARRAY(component, j, diana->components, diana->num_components) {
+		if(component->flags & DL_COMPONENT_MULTIPLE_BIT) {
+			for(i = 0; i < diana->dataHeight; i++) {
+				struct _componentBag *bag = (struct _componentBag *)(_getEntityData(diana, i) + component->offset);
+				_free(diana, bag->indexes);
+			}
 		}
 	}
 
-	_free(diana, diana->data);
+	for(i = 0; i < diana->processingDataCapacity; i++) {
+		_alignedFree(diana, diana->dataAlignment, diana->processingData[i]);
+	}
+	_free(diana, diana->processingData);
+
+#if DL_MMAP
+	if(diana->reservedBytes) {
+		munmap(diana->data, diana->reservedBytes);
+	} else
+#endif
+	_alignedFree(diana, diana->dataAlignment, diana->data);
+	_free(diana, diana->signatures);
 	_sparseIntegerSet_free(diana, &diana->freeEntityIds);
 	_sparseIntegerSet_free(diana, &diana->added);
 	_sparseIntegerSet_free(diana, &diana->enabled);
 	_sparseIntegerSet_free(diana, &diana->disabled);
 	_sparseIntegerSet_free(diana, &diana->deleted);
 	_denseIntegerSet_free(diana, &diana->active);
+#if DL_TRACE
+	diana_traceStop(diana);
+#endif
+#if DL_PERF_EVENT
+	_perf_close(diana);
+#endif
+#if DL_DELTA
+	_sparseIntegerSet_free(diana, &diana->deltaEntities);
+	_sparseIntegerSet_free(diana, &diana->deltaAdded);
+	_sparseIntegerSet_free(diana, &diana->deltaEnabled);
+	_sparseIntegerSet_free(diana, &diana->deltaDisabled);
+	_sparseIntegerSet_free(diana, &diana->deltaDeleted);
+#endif
 
 	FOREACH_ARRAY(component, i, diana->components, diana->num_components) {
 		_component_free(diana, component);
@@ -444,26 +1401,165 @@ int diana_free(struct diana *diana) {
 	}
 	_free(diana, diana->managers);
 
-	diana->free(diana);
+	diana->allocator.free(diana->allocator.userData, diana);
 
 	return DL_ERROR_NONE;
 }
 
 // ============================================================================
 // INITIALIZATION TIME
+// lay out a row: the component bits, then each component aligned, a computed one
+// after its dirty byte. rows are padded so every row is aligned like the first
+#if DL_LAYOUT_WATCHED
+// systems watching c: together with last, with some other placed one, and in all
+static void _layoutScore(struct diana *diana, unsigned int c, unsigned int last, unsigned int score[3]) {
+	struct _system *system;
+	unsigned int i, j, w;
+
+	score[0] = score[1] = score[2] = 0;
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		if(!_sparseIntegerSet_contains(diana, &system->watch, c)) {
+			continue;
+		}
+		score[2]++;
+		if(_sparseIntegerSet_contains(diana, &system->watch, last)) {
+			score[0]++;
+			continue;
+		}
+		FOREACH_SPARSEINTSET(w, j, &system->watch) {
+			if(diana->components[w].offset != SIZE_MAX) {
+				score[1]++;
+				break;
+			}
+		}
+	}
+}
+#endif
+
+// the next component to place: the one watched most often with the last placed,
+// then with the others placed, then the most watched, then the first created.
+// unplaced ones have offset SIZE_MAX
+static struct _component *_layoutNext(struct diana *diana, struct _component *last) {
+	struct _component *c, *best = NULL;
+	unsigned int n;
+#if DL_LAYOUT_WATCHED
+	unsigned int score[3], bestScore[3], k;
+#endif
+
+	FOREACH_ARRAY(c, n, diana->components, diana->num_components) {
+		if(c->offset != SIZE_MAX) {
+			continue;
+		}
+#if DL_LAYOUT_WATCHED
+		_layoutScore(diana, n, last != NULL ? last - diana->components : UINT_MAX, score);
+		for(k = 0; best != NULL && k < 3 && score[k] == bestScore[k]; k++);
+		if(best == NULL || (k < 3 && score[k] > bestScore[k])) {
+			best = c;
+			memcpy(bestScore, score, sizeof(score));
+		}
+#else
+		return c;
+#endif
+	}
+
+	return best;
+}
+
+static void _layout(struct diana *diana) {
+	size_t offset = 0, alignment = 1;
+	struct _component *c = NULL;
+	unsigned int n;
+
+#if DL_HANDLES
+	diana->generationOffset = DL_ALIGN(offset, sizeof(unsigned int));
+	offset = diana->generationOffset + sizeof(unsigned int);
+	alignment = sizeof(unsigned int);
+#endif
+
+	FOREACH_ARRAY(c, n, diana->components, diana->num_components) {
+		c->offset = SIZE_MAX;
+	}
+
+	for(c = _layoutNext(diana, NULL); c != NULL; c = _layoutNext(diana, c)) {
+		size_t size = c->size, a = c->alignment;
+
+		if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+			size = sizeof(struct _componentBag);
+			a = sizeof(void *);
+		} else if(c->flags & DL_COMPONENT_INDEXED_BIT) {
+			size = sizeof(unsigned int);
+			a = sizeof(unsigned int);
+		}
+
+#if DL_COMPUTE
+		if(c->compute) {
+			offset += sizeof(char);
+		}
+#endif
+
+		c->offset = DL_ALIGN(offset, a);
+		offset = c->offset + size;
+		alignment = a > alignment ? a : alignment;
+
+		c->stride = DL_ALIGN(c->size ? c->size : 1, c->alignment);
+		c->slabSlots = DL_SLAB_SIZE / c->stride ? DL_SLAB_SIZE / c->stride : 1;
+	}
+
+	// rows are counted by dividing by the width, an empty one still takes a byte
+	diana->dataAlignment = alignment;
+	diana->dataWidth = DL_ALIGN(offset ? offset : 1, alignment);
+}
+
 int diana_initialize(struct diana *diana) {
-	unsigned int extraBytes = (diana->num_components + 7) >> 3, n;
-	struct _component *c;
+	struct _system *system;
+	unsigned int i, j, component;
+	int err;
+
+#if DL_RECORD
+	_record_op(diana, DL_RECORD_INITIALIZE);
+#endif
 
 	if(diana->initialized) {
 		return DL_ERROR_INVALID_OPERATION;
 	}
 
-	FOREACH_ARRAY(c, n, diana->components, diana->num_components) {
-		c->offset += extraBytes;
+#if DL_RESERVED_ONLY
+	if(diana->reservedRows == 0) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+#endif
+
+	_layout(diana);
+
+	// a word even without components, so there is always something to point at
+	diana->signatureWords = (diana->num_components + DL_SIGNATURE_BITS - 1) / DL_SIGNATURE_BITS;
+	diana->signatureWords += diana->signatureWords == 0;
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		_free(diana, system->match);
+		err = _malloc(diana, sizeof(unsigned int) * diana->signatureWords * 2, (void **)&system->match);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+		FOREACH_SPARSEINTSET(component, j, &system->watch) {
+			_signature_set(system->match, component);
+		}
+		FOREACH_SPARSEINTSET(component, j, &system->exclude) {
+			_signature_set(system->match + diana->signatureWords, component);
+		}
 	}
 
-	diana->dataWidth += extraBytes;
+#if DL_MMAP
+	if(diana->reservedRows) {
+		size_t bytes = DL_ALIGN((size_t)diana->dataWidth * diana->reservedRows, sysconf(_SC_PAGESIZE));
+		void *data = mmap(NULL, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(data == MAP_FAILED) {
+			return DL_ERROR_OUT_OF_MEMORY;
+		}
+		diana->data = data;
+		diana->reservedBytes = bytes;
+		diana->reservedRows = bytes / diana->dataWidth;
+	}
+#endif
 
 	diana->initialized = 1;
 
@@ -486,6 +1582,11 @@ int diana_createComponent(
 		return DL_ERROR_INVALID_OPERATION;
 	}
 
+	// only a single instance can live in the row
+	if((flags & DL_COMPONENT_ADAPTIVE_BIT) && (flags & (DL_COMPONENT_MULTIPLE_BIT | DL_COMPONENT_LIMITED_BIT))) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
 	memset(&c, 0, sizeof(c));
 	err = _strdup(diana, name, (char **)&c.name);
 	if(err != DL_ERROR_NONE) {
@@ -493,26 +1594,11 @@ int diana_createComponent(
 	}
 	c.size = size;
 	c.flags = flags;
-	c.offset = diana->dataWidth;
 
-	if(flags & DL_COMPONENT_MULTIPLE_BIT) {
-		size = sizeof(struct _componentBag);
-	} else if(flags & DL_COMPONENT_INDEXED_BIT) {
-		size = sizeof(unsigned int);
-	}
-
-	diana->dataWidth += size;
-
-	if(flags & DL_COMPONENT_LIMITED_BIT) {
-		unsigned int count = (flags >> 3);
-		err = _malloc(diana, c.size * count, (void **)&c.data);
-		if(err != DL_ERROR_NONE) {
-			_free(diana, (void *)c.name);
-			return err;
-		}
-		while(count) {
-			_sparseIntegerSet_insert(diana, &c.freeDataIndexes, count--);
-		}
+	// the largest power of two dividing the size, up to what malloc aligns to
+	c.alignment = 1;
+	while(size && c.alignment < DL_MALLOC_ALIGNMENT && size % (c.alignment * 2) == 0) {
+		c.alignment *= 2;
 	}
 
 	err = _realloc(diana, diana->components, sizeof(*diana->components) * diana->num_components, sizeof(*diana->components) * (diana->num_components + 1), (void **)&diana->components);
@@ -521,14 +1607,31 @@ int diana_createComponent(
 		return err;
 	}
 	diana->components[diana->num_components++] = c;
+	diana->adaptiveComponents += (flags & DL_COMPONENT_ADAPTIVE_BIT) != 0;
 
 	*component_ptr = diana->num_components - 1;
 
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_CREATE_COMPONENT)) {
+		_record_name(diana, name);
+		_record_uint(diana, c.size);
+		_record_uint(diana, flags);
+		_record_uint(diana, *component_ptr);
+	}
+#endif
+
 	return err;
 }
 
 #if DL_COMPUTE
 int diana_componentCompute(struct diana *diana, unsigned int component, void (*compute)(struct diana *, void *, unsigned int entity, unsigned int index, void *), void *userData) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_COMPONENT_COMPUTE)) {
+		_record_uint(diana, component);
+		_record_uint(diana, compute != NULL);
+	}
+#endif
+
 	if(diana->initialized) {
 		return DL_ERROR_INVALID_OPERATION;
 	}
@@ -539,45 +1642,125 @@ int diana_componentCompute(struct diana *diana, unsigned int component, void (*c
 
 	diana->components[component].compute = compute;
 	diana->components[component].userData = userData;
-	diana->dataWidth += sizeof(char);
 
-	// give this component room
-	while(component < diana->num_components) {
-		diana->components[component].offset += sizeof(char);
-		component++;
+	return DL_ERROR_NONE;
+}
+#endif
+
+int diana_reserveAddressSpace(struct diana *diana, unsigned int entities) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_RESERVE_ADDRESS_SPACE)) {
+		_record_uint(diana, entities);
+	}
+#endif
+
+	if(diana->initialized || !DL_MMAP) {
+		return DL_ERROR_INVALID_OPERATION;
 	}
 
+	diana->reservedRows = entities;
+
 	return DL_ERROR_NONE;
 }
+
+int diana_componentAlignment(struct diana *diana, unsigned int component, size_t alignment) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_COMPONENT_ALIGNMENT)) {
+		_record_uint(diana, component);
+		_record_uint(diana, alignment);
+	}
 #endif
 
-// ============================================================================
-// system
-int diana_createSystem(
+	if(diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if(component >= diana->num_components || alignment == 0 || (alignment & (alignment - 1))) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	diana->components[component].alignment = alignment;
+
+	return DL_ERROR_NONE;
+}
+
+int diana_componentLifecycle(
 	struct diana *diana,
-	const char *name,
-	void (*starting)(struct diana *, void *),
-	void (*process)(struct diana *, void *, unsigned int, float),
-	void (*ending)(struct diana *, void *),
-	void (*subscribed)(struct diana *, void *, unsigned int),
-	void (*unsubscribed)(struct diana *, void *, unsigned int),
-	void *userData,
-	unsigned int flags,
-	unsigned int * system_ptr
+	unsigned int component,
+	int (*construct)(struct diana *, void *, void *data, const void *from),
+	void (*destruct)(struct diana *, void *, void *data),
+	void (*move)(struct diana *, void *, void *to, void *from),
+	void *userData
 ) {
-	struct _system s;
-	int err = DL_ERROR_NONE;
+	struct _component *c;
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_COMPONENT_LIFECYCLE)) {
+		_record_uint(diana, component);
+		_record_uint(diana, (construct != NULL) | (destruct != NULL) << 1 | (move != NULL) << 2);
+	}
+#endif
 
 	if(diana->initialized) {
 		return DL_ERROR_INVALID_OPERATION;
 	}
 
-	memset(&s, 0, sizeof(s));
-	err = _strdup(diana, name, (char **)&s.name);
-	if(err != DL_ERROR_NONE) {
-		return err;
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
 	}
-	s.starting = starting;
+
+	c = diana->components + component;
+
+	if(c->construct != NULL || c->destruct != NULL || c->move != NULL) {
+		diana->lifecycleComponents--;
+		if(c->move != NULL && !(c->flags & DL_COMPONENT_INDEXED_BIT)) {
+			diana->movingComponents--;
+		}
+	}
+
+	c->construct = construct;
+	c->destruct = destruct;
+	c->move = move;
+	c->lifecycleUserData = userData;
+
+	if(construct != NULL || destruct != NULL || move != NULL) {
+		diana->lifecycleComponents++;
+		// slots of indexed components never move
+		if(move != NULL && !(c->flags & DL_COMPONENT_INDEXED_BIT)) {
+			diana->movingComponents++;
+		}
+	}
+
+	return DL_ERROR_NONE;
+}
+
+// ============================================================================
+// system
+int diana_createSystem(
+	struct diana *diana,
+	const char *name,
+	void (*starting)(struct diana *, void *),
+	void (*process)(struct diana *, void *, unsigned int, float),
+	void (*ending)(struct diana *, void *),
+	void (*subscribed)(struct diana *, void *, unsigned int),
+	void (*unsubscribed)(struct diana *, void *, unsigned int),
+	void *userData,
+	unsigned int flags,
+	unsigned int * system_ptr
+) {
+	struct _system s;
+	int err = DL_ERROR_NONE;
+
+	if(diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	memset(&s, 0, sizeof(s));
+	err = _strdup(diana, name, (char **)&s.name);
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+	s.starting = starting;
 	s.process = process;
 	s.ending = ending;
 	s.subscribed = subscribed;
@@ -594,10 +1777,51 @@ int diana_createSystem(
 
 	*system_ptr = diana->num_systems - 1;
 
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_CREATE_SYSTEM)) {
+		_record_name(diana, name);
+		_record_uint(diana, flags);
+		_record_uint(diana, (starting != NULL) << DL_RECORD_STARTING |
+		                    (process != NULL) << DL_RECORD_PROCESS_ENTITY |
+		                    (ending != NULL) << DL_RECORD_ENDING |
+		                    (subscribed != NULL) << DL_RECORD_SUBSCRIBED |
+		                    (unsubscribed != NULL) << DL_RECORD_UNSUBSCRIBED);
+		_record_uint(diana, *system_ptr);
+	}
+#endif
+
 	return err;
 }
 
+int diana_systemBatch(struct diana *diana, unsigned int system, void (*batch)(struct diana *, void *, const unsigned int *entities, unsigned int count, float delta)) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_SYSTEM_BATCH)) {
+		_record_uint(diana, system);
+		_record_uint(diana, batch != NULL);
+	}
+#endif
+
+	if(diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if(system >= diana->num_systems) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	diana->systems[system].batch = batch;
+
+	return DL_ERROR_NONE;
+}
+
 int diana_watch(struct diana *diana, unsigned int system, unsigned int component) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_WATCH)) {
+		_record_uint(diana, system);
+		_record_uint(diana, component);
+	}
+#endif
+
 	if(diana->initialized) {
 		return DL_ERROR_INVALID_OPERATION;
 	}
@@ -616,6 +1840,13 @@ int diana_watch(struct diana *diana, unsigned int system, unsigned int component
 }
 
 int diana_exclude(struct diana *diana, unsigned int system, unsigned int component) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_EXCLUDE)) {
+		_record_uint(diana, system);
+		_record_uint(diana, component);
+	}
+#endif
+
 	if(diana->initialized) {
 		return DL_ERROR_INVALID_OPERATION;
 	}
@@ -674,715 +1905,3221 @@ int diana_createManager(
 
 	*manager_ptr = diana->num_managers - 1;
 
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_CREATE_MANAGER)) {
+		_record_name(diana, name);
+		_record_uint(diana, flags);
+		_record_uint(diana, (added != NULL) << DL_RECORD_ADDED |
+		                    (enabled != NULL) << DL_RECORD_ENABLED |
+		                    (disabled != NULL) << DL_RECORD_DISABLED |
+		                    (deleted != NULL) << DL_RECORD_DELETED);
+		_record_uint(diana, *manager_ptr);
+	}
+#endif
+
 	return err;
 }
 
 // ============================================================================
 // RUNTIME
 static unsigned char *_getEntityData(struct diana *diana, unsigned int entity) {
+#if !DL_RESERVED_ONLY
 	if(entity >= diana->dataHeightCapacity) {
 		return diana->processingData[entity - diana->dataHeightCapacity];
 	}
+#endif
 	return (void *)((unsigned char *)diana->data + (diana->dataWidth * entity));
 }
 
+static unsigned int *_getSignature(struct diana *diana, unsigned int entity) {
+	return diana->signatures + (size_t)diana->signatureWords * entity;
+}
+
+// nothing keeps a pointer into the signatures, so they move as they please
+static int _resizeSignatures(struct diana *diana, unsigned int capacity) {
+	size_t words = diana->signatureWords;
+	int err = _realloc(diana, diana->signatures, sizeof(unsigned int) * words * diana->signatureCapacity, sizeof(unsigned int) * words * capacity, (void **)&diana->signatures);
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+	diana->signatureCapacity = capacity;
+	return DL_ERROR_NONE;
+}
+
+#if DL_HANDLES
+static unsigned int *_generation(struct diana *diana, unsigned char *entityData) {
+	return (unsigned int *)(entityData + diana->generationOffset);
+}
+
+// rows about to be zeroed take their generations with them
+static void _dropGenerations(struct diana *diana, unsigned int from, unsigned int to) {
+	unsigned int i, generation;
+
+	for(i = from; i < to; i++) {
+		generation = *_generation(diana, _getEntityData(diana, i)) + 1;
+		diana->generationFloor = generation > diana->generationFloor ? generation : diana->generationFloor;
+	}
+}
+#endif
+
+#if DL_DELTA
+static void _delta_touch(struct diana *diana, unsigned int entity) {
+	_sparseIntegerSet_insert(diana, &diana->deltaEntities, entity);
+}
+
+static void _delta_change(struct diana *diana, unsigned int entity, unsigned int component) {
+	_sparseIntegerSet_insert(diana, &diana->deltaEntities, entity);
+	_denseIntegerSet_insert(diana, &diana->components[component].deltaChanged, entity);
+}
+#endif
+
 static void _subscribe(struct diana *diana, struct _system *system, unsigned int entity) {
 	int included = _denseIntegerSet_insert(diana, &system->entities, entity);
+#if DL_STATS
+	system->stats.subscribed += !included;
+#endif
 	if(!included && system->subscribed != NULL) {
+		RECORD_ENTER(diana, DL_RECORD_SUBSCRIBED, system - diana->systems, entity);
 		system->subscribed(diana, system->userData, entity);
+		RECORD_LEAVE(diana);
 	}
 }
 
 static void _unsubscribe(struct diana *diana, struct _system *system, unsigned int entity) {
 	int included = _denseIntegerSet_delete(diana, &system->entities, entity);
+#if DL_STATS
+	system->stats.unsubscribed += included;
+#endif
 	if(included && system->unsubscribed != NULL) {
+		RECORD_ENTER(diana, DL_RECORD_UNSUBSCRIBED, system - diana->systems, entity);
 		system->unsubscribed(diana, system->userData, entity);
+		RECORD_LEAVE(diana);
 	}
 }
 
 static void _check(struct diana *diana, struct _system *system, unsigned int entity) {
-	unsigned char *entity_components = _getEntityData(diana, entity);
-	unsigned int component, i;
-	int wanted = 1;
-
-	FOREACH_SPARSEINTSET(component, i, &system->watch) {
-		if(!(entity_components[component >> 3] & (1 << (component & 7)))) {
-			wanted = 0;
-			break;
-		}
-	}
+	unsigned int words = diana->signatureWords;
 
-	FOREACH_SPARSEINTSET(component, i, &system->exclude) {
-		if((entity_components[component >> 3] & (1 << (component & 7)))) {
-			wanted = 0;
-			break;
-		}
-	}
+#if DL_STATS
+	diana->stats.checks++;
+#endif
 
-	if(wanted) {
+	if(_signature_matches(_getSignature(diana, entity), system->match, system->match + words, words)) {
 		_subscribe(diana, system, entity);
 	} else {
 		_unsubscribe(diana, system, entity);
 	}
 }
 
-static int _fixData(struct diana *diana) {
-	// take care of spawns that happen during processing
-	if(diana->processingData != NULL) {
-		unsigned int newDataHeight = diana->dataHeight + diana->processingDataHeight, i;
+// the sets indexed by entity grow with the entity table. dense sets and the page
+// tables of sparse ones that is, their pages and populations grow as they are used
+static int _reserveEntities(struct diana *diana) {
+	struct _system *system;
+	unsigned int i, capacity = diana->dataHeightCapacity;
+	int err;
+
+	if((err = _sparseIntegerSet_reserve(diana, &diana->freeEntityIds, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_reserve(diana, &diana->added, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_reserve(diana, &diana->enabled, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_reserve(diana, &diana->disabled, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_reserve(diana, &diana->deleted, capacity)) != DL_ERROR_NONE ||
+	   (err = _denseIntegerSet_reserve(diana, &diana->active, capacity)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		err = _denseIntegerSet_reserve(diana, &system->entities, capacity);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+	}
+
+#if DL_DELTA
+	if((err = _sparseIntegerSet_reserve(diana, &diana->deltaEntities, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_reserve(diana, &diana->deltaAdded, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_reserve(diana, &diana->deltaEnabled, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_reserve(diana, &diana->deltaDisabled, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_reserve(diana, &diana->deltaDeleted, capacity)) != DL_ERROR_NONE) {
+		return err;
+	}
 
-		if(newDataHeight >= diana->dataHeightCapacity) {
-			unsigned int newDataHeightCapacity = (newDataHeight + 1) * 1.5;
-			int err = _realloc(diana, diana->data, diana->dataWidth * diana->dataHeightCapacity, diana->dataWidth * newDataHeightCapacity, (void **)&diana->data);
+	{
+		struct _component *c;
+		FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+			err = _denseIntegerSet_reserve(diana, &c->deltaChanged, capacity);
 			if(err != DL_ERROR_NONE) {
 				return err;
 			}
-			diana->dataHeightCapacity = newDataHeightCapacity;
 		}
-
-		for(i = 0; i < diana->processingDataHeight; i++) {
-			memcpy((unsigned char *)diana->data + (diana->dataWidth * (diana->dataHeight + i)), diana->processingData[i], diana->dataWidth);
-			diana->free(diana->processingData[i]);
-		}
-		diana->free(diana->processingData);
-
-		diana->dataHeight = newDataHeight;
-
-		diana->processingData = NULL;
-		diana->processingDataHeight = 0;
 	}
+#endif
 
 	return DL_ERROR_NONE;
 }
 
-int diana_process(struct diana *diana, float delta) {
-	unsigned int entity, i, j;
+// and shrink with it, every id in them is below the new capacity by now
+static int _shrinkEntities(struct diana *diana) {
 	struct _system *system;
-	struct _manager *manager;
-	
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+	unsigned int i, capacity = diana->dataHeightCapacity;
+	int err;
+
+	if((err = _sparseIntegerSet_shrink(diana, &diana->freeEntityIds, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_shrink(diana, &diana->added, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_shrink(diana, &diana->enabled, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_shrink(diana, &diana->disabled, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_shrink(diana, &diana->deleted, capacity)) != DL_ERROR_NONE ||
+	   (err = _denseIntegerSet_shrink(diana, &diana->active, capacity)) != DL_ERROR_NONE) {
+		return err;
 	}
 
-	diana->processing = 1;
-
-	FOREACH_SPARSEINTSET(entity, i, &diana->added) {
-		FOREACH_ARRAY(manager, j, diana->managers, diana->num_managers) {
-			if(manager->added != NULL) {
-				manager->added(diana, manager->userData, entity);
-			}
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		err = _denseIntegerSet_shrink(diana, &system->entities, capacity);
+		if(err != DL_ERROR_NONE) {
+			return err;
 		}
 	}
-	_sparseIntegerSet_clear(diana, &diana->added);
 
-	FOREACH_SPARSEINTSET(entity, i, &diana->enabled) {
-		FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
-			_check(diana, system, entity);
-		}
-		FOREACH_ARRAY(manager, j, diana->managers, diana->num_managers) {
-			if(manager->enabled != NULL) {
-				manager->enabled(diana, manager->userData, entity);
-			}
-		}
-		_denseIntegerSet_insert(diana, &diana->active, entity);
+#if DL_DELTA
+	if((err = _sparseIntegerSet_shrink(diana, &diana->deltaEntities, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_shrink(diana, &diana->deltaAdded, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_shrink(diana, &diana->deltaEnabled, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_shrink(diana, &diana->deltaDisabled, capacity)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_shrink(diana, &diana->deltaDeleted, capacity)) != DL_ERROR_NONE) {
+		return err;
 	}
-	_sparseIntegerSet_clear(diana, &diana->enabled);
 
-	FOREACH_SPARSEINTSET(entity, i, &diana->disabled) {
-		FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
-			_unsubscribe(diana, system, entity);
-		}
-		FOREACH_ARRAY(manager, j, diana->managers, diana->num_managers) {
-			if(manager->disabled != NULL) {
-				manager->disabled(diana, manager->userData, entity);
+	{
+		struct _component *c;
+		FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+			err = _denseIntegerSet_shrink(diana, &c->deltaChanged, capacity);
+			if(err != DL_ERROR_NONE) {
+				return err;
 			}
 		}
-		_denseIntegerSet_delete(diana, &diana->active, entity);
 	}
-	_sparseIntegerSet_clear(diana, &diana->disabled);
+#endif
 
-	FOREACH_SPARSEINTSET(entity, i, &diana->deleted) {
-		FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
-			_unsubscribe(diana, system, entity);
-		}
-		FOREACH_ARRAY(manager, j, diana->managers, diana->num_managers) {
-			if(manager->deleted != NULL) {
-				manager->deleted(diana, manager->userData, entity);
-			}
-		}
-		for(j = 0; j < diana->num_components; j++) {
-			diana_removeComponents(diana, entity, j);
-		}
-		_sparseIntegerSet_insert(diana, &diana->freeEntityIds, entity);
-	}
-	_sparseIntegerSet_clear(diana, &diana->deleted);
+	return DL_ERROR_NONE;
+}
 
-	FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
-		if(system->flags & DL_SYSTEM_PASSIVE_BIT) {
-			continue;
-		}
+// copy a row to new memory, inline components with a move hook are moved by it
+static void _moveRow(struct diana *diana, unsigned char *to, unsigned char *from, const unsigned int *signature) {
+	struct _component *c;
+	unsigned int i;
 
-		if(system->starting != NULL) {
-			system->starting(diana, system->userData);
-		}
-		FOREACH_DENSEINTSET(entity, &system->entities) {
-			system->process(diana, system->userData, entity, delta);
-		}
-		if(system->ending != NULL) {
-			system->ending(diana, system->userData);
-		}
-	}
+	memcpy(to, from, diana->dataWidth);
 
-	diana->processing = 0;
+	if(diana->movingComponents == 0) {
+		return;
+	}
 
-	return _fixData(diana);
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		if(c->move != NULL && !(c->flags & DL_COMPONENT_INDEXED_BIT) && _signature_isSet(signature, i)) {
+			c->move(diana, c->lifecycleUserData, to + c->offset, from + c->offset);
+		}
+	}
 }
 
-int diana_processSystem(struct diana *diana, unsigned int system, float delta) {
-	struct _system *s;
-	unsigned int entity;
+#if DL_MMAP
+// make more of the reserved range usable, the kernel hands out zeroed pages.
+// pages given back are dropped and zeroed again if they are committed later
+static int _commitData(struct diana *diana, unsigned int newDataHeightCapacity) {
+	size_t bytes;
 
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+	if(newDataHeightCapacity > diana->reservedRows) {
+		newDataHeightCapacity = diana->reservedRows;
 	}
-
-	if(system >= diana->num_systems) {
-		return DL_ERROR_INVALID_VALUE;
+	if(diana->dataHeight > newDataHeightCapacity) {
+		return DL_ERROR_OUT_OF_MEMORY;
 	}
 
-	s = diana->systems + system;
-
-	if(s->starting != NULL) {
-		s->starting(diana, s->userData);
+	bytes = DL_ALIGN((size_t)diana->dataWidth * newDataHeightCapacity, sysconf(_SC_PAGESIZE));
+	if(bytes > diana->reservedBytes) {
+		bytes = diana->reservedBytes;
 	}
-	FOREACH_DENSEINTSET(entity, &s->entities) {
-		s->process(diana, s->userData, entity, delta);
-	}
-	if(s->ending != NULL) {
-		s->ending(diana, s->userData);
+	if(bytes > diana->committedBytes) {
+		if(mprotect((unsigned char *)diana->data + diana->committedBytes, bytes - diana->committedBytes, PROT_READ | PROT_WRITE) != 0) {
+			return DL_ERROR_OUT_OF_MEMORY;
+		}
+		diana->committedBytes = bytes;
+	} else if(bytes < diana->committedBytes) {
+		madvise((unsigned char *)diana->data + bytes, diana->committedBytes - bytes, MADV_DONTNEED);
+		mprotect((unsigned char *)diana->data + bytes, diana->committedBytes - bytes, PROT_NONE);
+		diana->committedBytes = bytes;
 	}
 
-	return _fixData(diana);
-}
+	// the rest of the last page is usable too
+	diana->dataHeightCapacity = bytes / diana->dataWidth;
 
-// ============================================================================
-// entity
-int diana_spawn(struct diana *diana, unsigned int * entity_ptr) {
-	unsigned int r;
-	int err = DL_ERROR_NONE;
+	return DL_ERROR_NONE;
+}
+#endif
 
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
-	}
+// grow or shrink the entity table, rows past the new capacity have to be empty
+static int _resizeData(struct diana *diana, unsigned int newDataHeightCapacity) {
+	unsigned int oldDataHeightCapacity = diana->dataHeightCapacity;
+	int err;
 
-	if(_sparseIntegerSet_isEmpty(diana, &diana->freeEntityIds)) {
-		r = diana->nextEntityId++;
+#if DL_MMAP
+	if(diana->reservedBytes) {
+		err = _commitData(diana, newDataHeightCapacity);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+	} else
+#endif
+	if(diana->movingComponents == 0 && diana->dataAlignment <= DL_MALLOC_ALIGNMENT) {
+		err = _realloc(diana, diana->data, (size_t)diana->dataWidth * diana->dataHeightCapacity, (size_t)diana->dataWidth * newDataHeightCapacity, (void **)&diana->data);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+		diana->dataHeightCapacity = newDataHeightCapacity;
 	} else {
-		r = _sparseIntegerSet_pop(diana, &diana->freeEntityIds);
-	}
-
-	diana->dataHeight = diana->dataHeight > (r + 1) ? diana->dataHeight : (r + 1);
+		unsigned char *data = NULL;
+		unsigned int i, rows = oldDataHeightCapacity < newDataHeightCapacity ? oldDataHeightCapacity : newDataHeightCapacity;
 
-	if(diana->dataHeight > diana->dataHeightCapacity) {
-		if(diana->processing) {
-			void *entityData;
-		 
-			err = _malloc(diana, diana->dataWidth, &entityData);
+		if(newDataHeightCapacity > 0) {
+			err = _alignedMalloc(diana, diana->dataAlignment, (size_t)diana->dataWidth * newDataHeightCapacity, (void **)&data);
 			if(err != DL_ERROR_NONE) {
 				return err;
 			}
-
-			if(entityData == NULL) {
-				return 0;
-			}
-
-			err = _realloc(diana, diana->processingData, sizeof(*diana->processingData) * diana->processingDataHeight, sizeof(*diana->processingData) * (diana->processingDataHeight + 1), (void **)&diana->processingData);
-			if(err != DL_ERROR_NONE) {
-				return err;
+		}
+		if(diana->movingComponents == 0) {
+			if(rows > 0) {
+				memcpy(data, diana->data, (size_t)diana->dataWidth * rows);
 			}
-
-			diana->processingData[diana->processingDataHeight++] = entityData;
 		} else {
-			unsigned int newDataHeightCapacity = diana->dataHeight * 1.5;
-			err = _realloc(diana, diana->data, diana->dataWidth * diana->dataHeightCapacity, diana->dataWidth * newDataHeightCapacity, (void **)&diana->data);
-			if(err != DL_ERROR_NONE) {
-				return err;
+			// rows past the height are empty
+			for(i = 0; i < rows && i < diana->dataHeight; i++) {
+				_moveRow(diana, data + diana->dataWidth * i, (unsigned char *)diana->data + diana->dataWidth * i, _getSignature(diana, i));
 			}
-			diana->dataHeightCapacity = newDataHeightCapacity;
 		}
+		_alignedFree(diana, diana->dataAlignment, diana->data);
+		diana->data = data;
+		diana->dataHeightCapacity = newDataHeightCapacity;
 	}
 
-	*entity_ptr = r;
-
-	return err;
+	if(diana->dataHeightCapacity > oldDataHeightCapacity) {
+		return _reserveEntities(diana);
+	}
+	return DL_ERROR_NONE;
 }
 
-int diana_signal(struct diana *diana, unsigned int entity, unsigned int signal) {
-	int err = DL_ERROR_NONE;
-
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
-	}
+static int _fixData(struct diana *diana) {
+#if DL_TRACE
+	unsigned long long traceBegin = _traceBegin(diana);
+#endif
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
-	}
+	// take care of spawns that happen during processing
+	if(diana->processingDataHeight > 0) {
+		// processingData[i] holds the row of entity oldDataHeightCapacity + i, dataHeight already counts them
+		unsigned int oldDataHeightCapacity = diana->dataHeightCapacity, i;
 
+		if(diana->dataHeight >= diana->dataHeightCapacity) {
+			int err = _resizeData(diana, DL_GROW(diana->dataHeight + 1));
+			if(err != DL_ERROR_NONE) {
+				return err;
+			}
+		}
+
+		// the rows stay in processingData for the next frame that spawns past the table
+		for(i = 0; i < diana->processingDataHeight; i++) {
+			_moveRow(diana, (unsigned char *)diana->data + (diana->dataWidth * (oldDataHeightCapacity + i)), diana->processingData[i], _getSignature(diana, oldDataHeightCapacity + i));
+		}
+
+		diana->processingDataHeight = 0;
+	}
+
+#if DL_TRACE
+	_trace(diana, "fixData", traceBegin);
+#endif
+
+	return DL_ERROR_NONE;
+}
+
+// ============================================================================
+// capacity
+static int _reserveSlotPointers(struct diana *diana, struct _component *c, unsigned int capacity);
+static int _reserveSlabs(struct diana *diana, struct _component *c, unsigned int numSlabs);
+static int _getAComponentIndex(struct diana *diana, struct _component *c, unsigned int * index);
+
+static void _shrinkComponent(struct diana *diana, struct _component *c) {
+	unsigned int numSlabs, i;
+
+	_endDefragment(diana, c);
+
+	// free slots at the end are forgotten, so their slabs can go
+	while(c->nextDataIndex > 0 && _sparseIntegerSet_delete(diana, &c->freeDataIndexes, c->nextDataIndex - 1)) {
+		c->nextDataIndex--;
+	}
+
+	numSlabs = (c->nextDataIndex + c->slabSlots - 1) / c->slabSlots;
+	while(c->numSlabs > numSlabs) {
+		_alignedFree(diana, c->alignment, c->slabs[--c->numSlabs]);
+	}
+	if(c->slabCapacity > numSlabs && _realloc(diana, c->slabs, sizeof(void *) * c->slabCapacity, sizeof(void *) * numSlabs, (void **)&c->slabs) == DL_ERROR_NONE) {
+		c->slabCapacity = numSlabs;
+	}
+
+	if(c->dataCapacity > c->nextDataIndex && _realloc(diana, c->data, sizeof(void *) * c->dataCapacity, sizeof(void *) * c->nextDataIndex, (void **)&c->data) == DL_ERROR_NONE) {
+		c->dataCapacity = c->nextDataIndex;
+		_sparseIntegerSet_shrink(diana, &c->freeDataIndexes, c->nextDataIndex);
+	}
+
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		for(i = 0; i < diana->dataHeight; i++) {
+			struct _componentBag *bag = (struct _componentBag *)(_getEntityData(diana, i) + c->offset);
+			if(bag->capacity > bag->count && _realloc(diana, bag->indexes, sizeof(unsigned int) * bag->capacity, sizeof(unsigned int) * bag->count, (void **)&bag->indexes) == DL_ERROR_NONE) {
+				bag->capacity = bag->count;
+			}
+		}
+	}
+}
+
+// rows from height on only hold free ids, drop what their bags kept and make them as new
+static void _truncateRows(struct diana *diana, unsigned int height) {
+	struct _component *c;
+	struct _system *system;
+	unsigned int i, j;
+
+#if DL_HANDLES
+	_dropGenerations(diana, height, diana->dataHeight);
+#endif
+
+	for(i = height; i < diana->dataHeight; i++) {
+		unsigned char *entityData = _getEntityData(diana, i);
+		FOREACH_ARRAY(c, j, diana->components, diana->num_components) {
+			if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+				_free(diana, ((struct _componentBag *)(entityData + c->offset))->indexes);
+			}
+		}
+		memset(entityData, 0, diana->dataWidth);
+		memset(_getSignature(diana, i), 0, sizeof(unsigned int) * diana->signatureWords);
+		_denseIntegerSet_delete(diana, &diana->active, i);
+		FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
+			_denseIntegerSet_delete(diana, &system->entities, i);
+		}
+	}
+	diana->dataHeight = height;
+}
+
+// give back what the world holds past what it uses. ids are rows, so only free
+// ids at the end shorten the table, a trailing id a delta still has to describe stays
+static int _shrink(struct diana *diana) {
+	unsigned int keep = 0, i;
+#if DL_DELTA
+	unsigned int j;
+#endif
+	struct _component *c;
+	int err;
+
+#if DL_DELTA
+	FOREACH_SPARSEINTSET(j, i, &diana->deltaEntities) {
+		keep = j + 1 > keep ? j + 1 : keep;
+	}
+#endif
+
+	while(diana->nextEntityId > keep && _sparseIntegerSet_delete(diana, &diana->freeEntityIds, diana->nextEntityId - 1)) {
+		diana->nextEntityId--;
+	}
+
+	_truncateRows(diana, diana->nextEntityId);
+
+	for(i = 0; i < diana->processingDataCapacity; i++) {
+		_alignedFree(diana, diana->dataAlignment, diana->processingData[i]);
+	}
+	_free(diana, diana->processingData);
+	diana->processingData = NULL;
+	diana->processingDataCapacity = 0;
+
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		_shrinkComponent(diana, c);
+	}
+
+	// a rollback can leave ids a delta describes past the table's height, their rows stay
+	keep = diana->dataHeight > keep ? diana->dataHeight : keep;
+	if(keep < diana->dataHeightCapacity) {
+		err = _resizeData(diana, keep);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+	}
+	if(keep < diana->signatureCapacity) {
+		_resizeSignatures(diana, keep);
+	}
+
+	return _shrinkEntities(diana);
+}
+
+// only what a shrink can give back counts: a table whose last id is in use
+// can not get shorter than it, whatever the number of free ids
+static int _wantsShrink(struct diana *diana) {
+	unsigned int factor = diana->shrinkFactor, used, i;
+	size_t slack = 0;
+	struct _component *c;
+
+#if DL_MMAP
+	// the table gives back whole pages
+	if(diana->reservedBytes) {
+		slack = sysconf(_SC_PAGESIZE);
+	}
+#endif
+
+	used = diana->nextEntityId;
+	if(used > 0 && _sparseIntegerSet_contains(diana, &diana->freeEntityIds, used - 1)) {
+		used -= diana->freeEntityIds.population;
+	}
+	if((size_t)diana->dataWidth * diana->dataHeightCapacity > (size_t)diana->dataWidth * used * factor + slack) {
+		return 1;
+	}
+
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		used = c->nextDataIndex;
+		if(used > 0 && _sparseIntegerSet_contains(diana, &c->freeDataIndexes, used - 1)) {
+			used -= c->freeDataIndexes.population;
+		}
+		if(c->dataCapacity > (size_t)used * factor) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int diana_reserve(struct diana *diana, unsigned int entities) {
+	int err;
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_RESERVE)) {
+		_record_uint(diana, entities);
+	}
+#endif
+
+	if(!diana->initialized || diana->processing) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if(entities > diana->dataHeightCapacity && (err = _resizeData(diana, entities)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	// sparse sets only get pages where ids show up, a reservation makes them all
+	if((err = _sparseIntegerSet_commit(diana, &diana->freeEntityIds, entities)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->added, entities)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->enabled, entities)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->disabled, entities)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deleted, entities)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+#if DL_DELTA
+	if((err = _sparseIntegerSet_commit(diana, &diana->deltaEntities, entities)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deltaAdded, entities)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deltaEnabled, entities)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deltaDisabled, entities)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deltaDeleted, entities)) != DL_ERROR_NONE) {
+		return err;
+	}
+#endif
+
+	return DL_ERROR_NONE;
+}
+
+int diana_reserveComponent(struct diana *diana, unsigned int component, unsigned int count) {
+	struct _component *c;
+	int err;
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_RESERVE_COMPONENT)) {
+		_record_uint(diana, component);
+		_record_uint(diana, count);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	c = diana->components + component;
+
+	// inline components live in the entity table
+	if(!(c->flags & DL_COMPONENT_INDEXED_BIT)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if((c->flags & DL_COMPONENT_LIMITED_BIT) && count > (c->flags >> 3)) {
+		count = c->flags >> 3;
+	}
+
+	if((err = _reserveSlotPointers(diana, c, count)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &c->freeDataIndexes, count)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	return _reserveSlabs(diana, c, (count + c->slabSlots - 1) / c->slabSlots);
+}
+
+int diana_shrink(struct diana *diana) {
+#if DL_RECORD
+	_record_op(diana, DL_RECORD_SHRINK);
+#endif
+
+	if(!diana->initialized || diana->processing) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	return _shrink(diana);
+}
+
+int diana_autoShrink(struct diana *diana, unsigned int factor) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_AUTO_SHRINK)) {
+		_record_uint(diana, factor);
+	}
+#endif
+
+	diana->shrinkFactor = factor;
+
+	return DL_ERROR_NONE;
+}
+
+// the index in entity's row or bag that names slot, NULL when entity does not use it
+static unsigned int *_slotIndex(struct diana *diana, struct _component *c, unsigned int entity, unsigned int slot) {
+	unsigned char *entityData;
+	unsigned int i;
+
+	if(entity >= diana->dataHeight) {
+		return NULL;
+	}
+	if(!_signature_isSet(_getSignature(diana, entity), c - diana->components)) {
+		return NULL;
+	}
+	entityData = _getEntityData(diana, entity);
+
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+		for(i = 0; i < bag->count; i++) {
+			if(bag->indexes[i] == slot) {
+				return bag->indexes + i;
+			}
+		}
+		return NULL;
+	}
+
+	return *(unsigned int *)(entityData + c->offset) == slot ? (unsigned int *)(entityData + c->offset) : NULL;
+}
+
+static void _swapSlots(struct diana *diana, struct _component *c, unsigned int a, unsigned int b) {
+	unsigned char *x = c->data[a], *y = c->data[b], t[64];
+	size_t n, k;
+
+	if(c->move != NULL) {
+		c->move(diana, c->lifecycleUserData, c->defragScratch, x);
+		c->move(diana, c->lifecycleUserData, x, y);
+		c->move(diana, c->lifecycleUserData, y, c->defragScratch);
+		return;
+	}
+
+	for(n = 0; n < c->size; n += k) {
+		k = c->size - n < sizeof(t) ? c->size - n : sizeof(t);
+		memcpy(t, x + n, k);
+		memcpy(x + n, y + n, k);
+		memcpy(y + n, t, k);
+	}
+}
+
+static int _startDefragment(struct diana *diana, struct _component *c) {
+	unsigned int entity, i;
+	int err;
+
+	if(c->move != NULL && c->defragScratch == NULL) {
+		err = _alignedMalloc(diana, c->alignment, c->stride, &c->defragScratch);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+	}
+
+	err = _malloc(diana, sizeof(unsigned int) * c->dataCapacity, (void **)&c->owners);
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+
+	for(entity = 0; entity < diana->dataHeight; entity++) {
+		unsigned char *entityData = _getEntityData(diana, entity);
+		if(!_signature_isSet(_getSignature(diana, entity), c - diana->components)) {
+			continue;
+		}
+		if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+			struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+			for(i = 0; i < bag->count; i++) {
+				c->owners[bag->indexes[i]] = entity;
+			}
+		} else {
+			c->owners[*(unsigned int *)(entityData + c->offset)] = entity;
+		}
+	}
+
+	c->defragEntity = 0;
+	c->defragSlot = 0;
+
+	return DL_ERROR_NONE;
+}
+
+// carry a pass on, every row looked at and every slot moved costs one of budget.
+// entity e's slots go to defragSlot on, what was there goes where e's slot was.
+// returns 1 when the pass is over
+static int _defragmentStep(struct diana *diana, struct _component *c, unsigned int *budget) {
+	unsigned int entity, count, k, i, *indexes;
+	int tail;
+
+	while(*budget > 0 && c->defragEntity < diana->dataHeight) {
+		unsigned char *entityData = _getEntityData(diana, entity = c->defragEntity++);
+
+		(*budget)--;
+		if(!_signature_isSet(_getSignature(diana, entity), c - diana->components)) {
+			continue;
+		}
+
+		if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+			struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+			indexes = bag->indexes;
+			count = bag->count;
+		} else {
+			indexes = (unsigned int *)(entityData + c->offset);
+			count = 1;
+		}
+
+		for(k = 0; k < count; k++) {
+			unsigned int from = indexes[k], to = c->defragSlot++;
+
+			if(from == to) {
+				continue;
+			}
+			// the world changed under the pass
+			if(to >= c->nextDataIndex) {
+				_endDefragment(diana, c);
+				return 1;
+			}
+
+			*budget -= *budget > 0;
+			if(_sparseIntegerSet_delete(diana, &c->freeDataIndexes, to)) {
+				if(c->move != NULL) {
+					c->move(diana, c->lifecycleUserData, c->data[to], c->data[from]);
+				} else {
+					memcpy(c->data[to], c->data[from], c->size);
+				}
+				_sparseIntegerSet_insert(diana, &c->freeDataIndexes, from);
+			} else {
+				unsigned int owner = c->owners[to], *other = _slotIndex(diana, c, owner, to);
+				if(other == NULL) {
+					_endDefragment(diana, c);
+					return 1;
+				}
+				_swapSlots(diana, c, from, to);
+				*other = from;
+				c->owners[from] = owner;
+			}
+			indexes[k] = to;
+			c->owners[to] = entity;
+		}
+	}
+
+	if(c->defragEntity < diana->dataHeight) {
+		return 0;
+	}
+
+	// when the free slots are exactly the ones past those handed out, the free list
+	// is rebuilt so the lowest pops first and new slots fill in from the front.
+	// entities deleted mid pass leave holes below, the next pass closes them
+	tail = c->freeDataIndexes.population == c->nextDataIndex - c->defragSlot;
+	for(i = c->defragSlot; tail && i < c->nextDataIndex; i++) {
+		tail = _sparseIntegerSet_contains(diana, &c->freeDataIndexes, i);
+	}
+	if(tail) {
+		_sparseIntegerSet_clear(diana, &c->freeDataIndexes);
+		for(i = c->nextDataIndex; i-- > c->defragSlot;) {
+			_sparseIntegerSet_insert(diana, &c->freeDataIndexes, i);
+		}
+	}
+
+	_endDefragment(diana, c);
+	return 1;
+}
+
+int diana_defragment(struct diana *diana, unsigned int budget) {
+	unsigned int passes = 0;
+	struct _component *c;
+	int err;
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_DEFRAGMENT)) {
+		_record_uint(diana, budget);
+	}
+#endif
+
+	if(!diana->initialized || diana->processing) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	// one pass per component at most, a finished one starts over on the next call
+	while(budget > 0 && passes < diana->num_components) {
+		c = diana->components + diana->defragComponent;
+
+		if((c->flags & DL_COMPONENT_INDEXED_BIT) && c->nextDataIndex > 0) {
+			if(c->owners == NULL && (err = _startDefragment(diana, c)) != DL_ERROR_NONE) {
+				return err;
+			}
+			if(!_defragmentStep(diana, c, &budget)) {
+				break;
+			}
+		}
+
+		diana->defragComponent = (diana->defragComponent + 1) % diana->num_components;
+		passes++;
+	}
+
+	return DL_ERROR_NONE;
+}
+
+// move entity from to the free id to, every set that names it follows
+static void _moveEntity(struct diana *diana, unsigned int from, unsigned int to) {
+	unsigned char *fromData = _getEntityData(diana, from), *toData = _getEntityData(diana, to);
+	struct _component *c;
+	struct _system *system;
+	unsigned int i;
+#if DL_HANDLES
+	unsigned int toGeneration, fromGeneration;
+#endif
+
+	// a free row can still hold the bags of the entity it had
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+			_free(diana, ((struct _componentBag *)(toData + c->offset))->indexes);
+		}
+	}
+#if DL_HANDLES
+	// each id keeps its own generation, the one left behind is dropped with its row
+	toGeneration = *_generation(diana, toData);
+	fromGeneration = *_generation(diana, fromData);
+#endif
+	_moveRow(diana, toData, fromData, _getSignature(diana, from));
+	memset(fromData, 0, diana->dataWidth);
+	memcpy(_getSignature(diana, to), _getSignature(diana, from), sizeof(unsigned int) * diana->signatureWords);
+	memset(_getSignature(diana, from), 0, sizeof(unsigned int) * diana->signatureWords);
+#if DL_HANDLES
+	*_generation(diana, toData) = toGeneration;
+	*_generation(diana, fromData) = fromGeneration;
+#endif
+
+	if(_denseIntegerSet_delete(diana, &diana->active, from)) {
+		_denseIntegerSet_insert(diana, &diana->active, to);
+	}
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		if(_denseIntegerSet_delete(diana, &system->entities, from)) {
+			_denseIntegerSet_insert(diana, &system->entities, to);
+		}
+	}
+
+	if(_sparseIntegerSet_delete(diana, &diana->added, from)) {
+		_sparseIntegerSet_insert(diana, &diana->added, to);
+	}
+	if(_sparseIntegerSet_delete(diana, &diana->enabled, from)) {
+		_sparseIntegerSet_insert(diana, &diana->enabled, to);
+	}
+	if(_sparseIntegerSet_delete(diana, &diana->disabled, from)) {
+		_sparseIntegerSet_insert(diana, &diana->disabled, to);
+	}
+	if(_sparseIntegerSet_delete(diana, &diana->deleted, from)) {
+		_sparseIntegerSet_insert(diana, &diana->deleted, to);
+	}
+}
+
+int diana_compact(struct diana *diana, void (*remap)(struct diana *, void *, unsigned int oldEntity, unsigned int newEntity), void *userData) {
+	unsigned int live, to, from;
+	struct _component *c;
+
+#if DL_RECORD
+	_record_op(diana, DL_RECORD_COMPACT);
+#endif
+
+	if(!diana->initialized || diana->processing) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+#if DL_DELTA
+	// a delta names ids, one that is not out yet would name the wrong entities
+	if(!_sparseIntegerSet_isEmpty(diana, &diana->deltaEntities)) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+#endif
+
+	// passes map slots to entities
+	FOREACH_ARRAY(c, to, diana->components, diana->num_components) {
+		_endDefragment(diana, c);
+	}
+
+	// the last live entities fill the first free ids until the live ones are a prefix
+	live = diana->nextEntityId - diana->freeEntityIds.population;
+	from = diana->nextEntityId;
+	for(to = 0; to < live; to++) {
+		if(!_sparseIntegerSet_contains(diana, &diana->freeEntityIds, to)) {
+			continue;
+		}
+		while(_sparseIntegerSet_contains(diana, &diana->freeEntityIds, --from));
+
+		_moveEntity(diana, from, to);
+		if(remap != NULL) {
+			remap(diana, userData, from, to);
+		}
+	}
+
+	_sparseIntegerSet_clear(diana, &diana->freeEntityIds);
+	diana->nextEntityId = live;
+	_truncateRows(diana, live);
+
+	return DL_ERROR_NONE;
+}
+
+// ============================================================================
+// adaptive
+static unsigned int _countComponent(struct diana *diana, struct _component *c) {
+	unsigned int i, n = 0;
+
+	if(c->flags & DL_COMPONENT_INDEXED_BIT) {
+		return c->nextDataIndex - c->freeDataIndexes.population;
+	}
+
+	for(i = 0; i < diana->dataHeight; i++) {
+		n += _signature_isSet(_getSignature(diana, i), c - diana->components);
+	}
+
+	return n;
+}
+
+// the table is copied into a new layout with the INDEXED bit flipped on the
+// components to migrate, data moves between the rows and slots as it goes
+static int _relayout(struct diana *diana) {
+	struct _layoutWas {
+		size_t offset;
+		unsigned int flags;
+	} *was = NULL;
+	unsigned char *data = NULL, *oldData = diana->data;
+	size_t oldWidth = diana->dataWidth, oldAlignment = diana->dataAlignment;
+	unsigned int i, e, index, count;
+	struct _component *c;
+	int err;
+
+	err = _malloc(diana, sizeof(*was) * diana->num_components, (void **)&was);
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+
+	// room for every slot up front, nothing fails half way through the copy
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		was[i].offset = c->offset;
+		was[i].flags = c->flags;
+		_endDefragment(diana, c);
+		if(!c->migrate || (c->flags & DL_COMPONENT_INDEXED_BIT)) {
+			continue;
+		}
+		count = _countComponent(diana, c);
+		if((err = _reserveSlotPointers(diana, c, count)) != DL_ERROR_NONE ||
+		   (err = _reserveSlabs(diana, c, (count + c->slabSlots - 1) / c->slabSlots)) != DL_ERROR_NONE) {
+			_free(diana, was);
+			return err;
+		}
+	}
+
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		c->flags ^= c->migrate ? DL_COMPONENT_INDEXED_BIT : 0;
+	}
+	_layout(diana);
+
+	if(diana->dataHeightCapacity > 0) {
+		err = _alignedMalloc(diana, diana->dataAlignment, diana->dataWidth * diana->dataHeightCapacity, (void **)&data);
+		if(err != DL_ERROR_NONE) {
+			FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+				c->flags = was[i].flags;
+			}
+			_layout(diana);
+			_free(diana, was);
+			return err;
+		}
+	}
+
+	for(e = 0; e < diana->dataHeight; e++) {
+		unsigned char *from = oldData + oldWidth * e, *to = data + diana->dataWidth * e;
+		const unsigned int *signature = _getSignature(diana, e);
+
+#if DL_HANDLES
+		*_generation(diana, to) = *(unsigned int *)(from + diana->generationOffset);
+#endif
+
+		FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+			void *fromData = from + was[i].offset, *toData = to + c->offset;
+
+#if DL_COMPUTE
+			if(c->compute) {
+				to[c->offset - 1] = from[was[i].offset - 1];
+			}
+#endif
+
+			// bags outlive their instances
+			if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+				memcpy(toData, fromData, sizeof(struct _componentBag));
+				continue;
+			}
+			if(!_signature_isSet(signature, i)) {
+				continue;
+			}
+
+			if(was[i].flags & c->flags & DL_COMPONENT_INDEXED_BIT) {
+				memcpy(toData, fromData, sizeof(unsigned int));
+				continue;
+			}
+
+			if(was[i].flags & DL_COMPONENT_INDEXED_BIT) {
+				index = *(unsigned int *)fromData;
+				fromData = c->data[index];
+				_sparseIntegerSet_insert(diana, &c->freeDataIndexes, index);
+			} else if(c->flags & DL_COMPONENT_INDEXED_BIT) {
+				// reserved above, a slot is there
+				_getAComponentIndex(diana, c, &index);
+				*(unsigned int *)toData = index;
+				toData = c->data[index];
+			}
+
+			if(c->move != NULL) {
+				c->move(diana, c->lifecycleUserData, toData, fromData);
+			} else {
+				memcpy(toData, fromData, c->size);
+			}
+		}
+	}
+
+	_alignedFree(diana, oldAlignment, oldData);
+	diana->data = data;
+
+	// spare rows for spawns while processing have the old width
+	for(i = 0; i < diana->processingDataCapacity; i++) {
+		_alignedFree(diana, oldAlignment, diana->processingData[i]);
+	}
+	_free(diana, diana->processingData);
+	diana->processingData = NULL;
+	diana->processingDataCapacity = 0;
+
+	diana->movingComponents = 0;
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		diana->movingComponents += c->move != NULL && !(c->flags & DL_COMPONENT_INDEXED_BIT);
+		// slots of components now in the row are all free
+		if(c->migrate && !(c->flags & DL_COMPONENT_INDEXED_BIT)) {
+			_shrinkComponent(diana, c);
+		}
+	}
+
+	diana->layouts++;
+	_free(diana, was);
+
+	return DL_ERROR_NONE;
+}
+
+// at the end of a frame, adaptive components used by many entities move into the
+// row and ones used by few move out to slots
+static int _adapt(struct diana *diana) {
+	unsigned int live = diana->nextEntityId - diana->freeEntityIds.population, used, i, moves = 0;
+	struct _component *c;
+
+#if DL_MMAP
+	// rows in reserved address space never move
+	if(diana->reservedBytes) {
+		return DL_ERROR_NONE;
+	}
+#endif
+
+	// nothing is allocated unless something moves, a warmed up world stays quiet
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		c->migrate = 0;
+		if(!(c->flags & DL_COMPONENT_ADAPTIVE_BIT)) {
+			continue;
+		}
+		used = _countComponent(diana, c);
+		if(c->flags & DL_COMPONENT_INDEXED_BIT) {
+			c->migrate = (unsigned long long)used * 100 > (unsigned long long)live * DL_ADAPTIVE_INLINE;
+		} else {
+			c->migrate = (unsigned long long)used * 100 < (unsigned long long)live * DL_ADAPTIVE_INDEXED;
+		}
+		moves += c->migrate;
+	}
+
+	return moves ? _relayout(diana) : DL_ERROR_NONE;
+}
+
+static void _processBatch(struct diana *diana, struct _system *system, const unsigned int *entities, unsigned int count, float delta) {
+	RECORD_ENTER(diana, DL_RECORD_PROCESS_BATCH, system - diana->systems, entities[0]);
+	system->batch(diana, system->userData, entities, count, delta);
+	RECORD_LEAVE(diana);
+#if DL_STATS
+	system->stats.entities += count;
+#endif
+}
+
+static void _processSystem(struct diana *diana, struct _system *system, float delta) {
+	unsigned int entity, batch[DL_BATCH_SIZE], count = 0;
+#if DL_STATS
+	unsigned long long t0 = _now(), t1, t2;
+#endif
+#if DL_PERF_EVENT
+	unsigned long long perf0[4], perf1[4];
+	int perf;
+#endif
+#if DL_TRACE
+	unsigned long long traceBegin = _traceBegin(diana);
+#endif
+
+	if(system->starting != NULL) {
+		RECORD_ENTER(diana, DL_RECORD_STARTING, system - diana->systems, 0);
+		system->starting(diana, system->userData);
+		RECORD_LEAVE(diana);
+	}
+#if DL_STATS
+	t1 = _now();
+#endif
+#if DL_PERF_EVENT
+	perf = _perf_read(diana, perf0);
+#endif
+	if(system->batch != NULL) {
+		FOREACH_DENSEINTSET(entity, &system->entities) {
+			batch[count++] = entity;
+			if(count == DL_BATCH_SIZE) {
+				_processBatch(diana, system, batch, count, delta);
+				count = 0;
+			}
+		}
+		if(count > 0) {
+			_processBatch(diana, system, batch, count, delta);
+		}
+	} else if(system->process != NULL) {
+		FOREACH_DENSEINTSET(entity, &system->entities) {
+			RECORD_ENTER(diana, DL_RECORD_PROCESS_ENTITY, system - diana->systems, entity);
+			system->process(diana, system->userData, entity, delta);
+			RECORD_LEAVE(diana);
+#if DL_STATS
+			system->stats.entities++;
+#endif
+		}
+	}
+#if DL_PERF_EVENT
+	if(perf && _perf_read(diana, perf1)) {
+		system->stats.cycles += perf1[0] - perf0[0];
+		system->stats.instructions += perf1[1] - perf0[1];
+		system->stats.cacheMisses += perf1[2] - perf0[2];
+		system->stats.branchMisses += perf1[3] - perf0[3];
+	}
+#endif
+#if DL_STATS
+	t2 = _now();
+#endif
+	if(system->ending != NULL) {
+		RECORD_ENTER(diana, DL_RECORD_ENDING, system - diana->systems, 0);
+		system->ending(diana, system->userData);
+		RECORD_LEAVE(diana);
+	}
+#if DL_STATS
+	system->stats.startingTime += t1 - t0;
+	system->stats.processTime += t2 - t1;
+	system->stats.endingTime += _now() - t2;
+#endif
+#if DL_TRACE
+	_trace(diana, system->name != NULL ? system->name : "system", traceBegin);
+#endif
+}
+
+int diana_process(struct diana *diana, float delta) {
+	unsigned int entity, i, j;
+	struct _system *system;
+	struct _manager *manager;
+	int err;
+#if DL_STATS
+	unsigned long long start = _now();
+#endif
+#if DL_TRACE
+	unsigned long long traceFrame = _traceBegin(diana), tracePhase = traceFrame;
+#endif
+	
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_PROCESS)) {
+		_record_float(diana, delta);
+	}
+#endif
+
+	diana->processing = 1;
+
+#if DL_STATS
+	diana->stats.frames++;
+	diana->stats.added += diana->added.population;
+	diana->stats.enabled += diana->enabled.population;
+	diana->stats.disabled += diana->disabled.population;
+	diana->stats.deleted += diana->deleted.population;
+#endif
+
+	FOREACH_SPARSEINTSET(entity, i, &diana->added) {
+		FOREACH_ARRAY(manager, j, diana->managers, diana->num_managers) {
+			if(manager->added != NULL) {
+				RECORD_ENTER(diana, DL_RECORD_ADDED, j, entity);
+				manager->added(diana, manager->userData, entity);
+				RECORD_LEAVE(diana);
+			}
+		}
+	}
+	_sparseIntegerSet_clear(diana, &diana->added);
+#if DL_TRACE
+	_trace(diana, "added", tracePhase);
+	tracePhase = _traceBegin(diana);
+#endif
+
+	FOREACH_SPARSEINTSET(entity, i, &diana->enabled) {
+		FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
+			_check(diana, system, entity);
+		}
+		FOREACH_ARRAY(manager, j, diana->managers, diana->num_managers) {
+			if(manager->enabled != NULL) {
+				RECORD_ENTER(diana, DL_RECORD_ENABLED, j, entity);
+				manager->enabled(diana, manager->userData, entity);
+				RECORD_LEAVE(diana);
+			}
+		}
+		_denseIntegerSet_insert(diana, &diana->active, entity);
+	}
+	_sparseIntegerSet_clear(diana, &diana->enabled);
+#if DL_TRACE
+	_trace(diana, "enabled", tracePhase);
+	tracePhase = _traceBegin(diana);
+#endif
+
+	FOREACH_SPARSEINTSET(entity, i, &diana->disabled) {
+		FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
+			_unsubscribe(diana, system, entity);
+		}
+		FOREACH_ARRAY(manager, j, diana->managers, diana->num_managers) {
+			if(manager->disabled != NULL) {
+				RECORD_ENTER(diana, DL_RECORD_DISABLED, j, entity);
+				manager->disabled(diana, manager->userData, entity);
+				RECORD_LEAVE(diana);
+			}
+		}
+		_denseIntegerSet_delete(diana, &diana->active, entity);
+	}
+	_sparseIntegerSet_clear(diana, &diana->disabled);
+#if DL_TRACE
+	_trace(diana, "disabled", tracePhase);
+	tracePhase = _traceBegin(diana);
+#endif
+
+	FOREACH_SPARSEINTSET(entity, i, &diana->deleted) {
+		FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
+			_unsubscribe(diana, system, entity);
+		}
+		FOREACH_ARRAY(manager, j, diana->managers, diana->num_managers) {
+			if(manager->deleted != NULL) {
+				RECORD_ENTER(diana, DL_RECORD_DELETED, j, entity);
+				manager->deleted(diana, manager->userData, entity);
+				RECORD_LEAVE(diana);
+			}
+		}
+		_removeAllComponents(diana, entity);
+		_sparseIntegerSet_insert(diana, &diana->freeEntityIds, entity);
+#if DL_HANDLES
+		(*_generation(diana, _getEntityData(diana, entity)))++;
+#endif
+	}
+	_sparseIntegerSet_clear(diana, &diana->deleted);
+#if DL_TRACE
+	_trace(diana, "deleted", tracePhase);
+#endif
+
+#if DL_STATS
+	diana->stats.bookkeepingTime += _now() - start;
+#endif
+
+	FOREACH_ARRAY(system, j, diana->systems, diana->num_systems) {
+		if(system->flags & DL_SYSTEM_PASSIVE_BIT) {
+			continue;
+		}
+		_processSystem(diana, system, delta);
+	}
+
+	diana->processing = 0;
+
+	err = _fixData(diana);
+
+	if(err == DL_ERROR_NONE && diana->adaptiveComponents && ++diana->adaptiveFrames >= DL_ADAPTIVE_FRAMES) {
+		diana->adaptiveFrames = 0;
+		err = _adapt(diana);
+	}
+
+	if(err == DL_ERROR_NONE && diana->shrinkFactor && _wantsShrink(diana)) {
+		err = _shrink(diana);
+	}
+
+#if DL_STATS
+	diana->stats.processTime += _now() - start;
+#endif
+#if DL_TRACE
+	_trace(diana, "diana_process", traceFrame);
+	diana->traceFrame++;
+#endif
+
+	return err;
+}
+
+int diana_processSystem(struct diana *diana, unsigned int system, float delta) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_PROCESS_SYSTEM)) {
+		_record_uint(diana, system);
+		_record_float(diana, delta);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if(system >= diana->num_systems) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	_processSystem(diana, diana->systems + system, delta);
+
+	return _fixData(diana);
+}
+
+// ============================================================================
+// entity
+static int _allocateRow(struct diana *diana, unsigned int r) {
+	int err = DL_ERROR_NONE;
+#if DL_HANDLES
+	unsigned int i = diana->dataHeight;
+#endif
+
+	// ahead of the table, which a reservation may have made longer already
+	if(r >= diana->signatureCapacity) {
+		err = _resizeSignatures(diana, DL_GROW(r + 1) > diana->dataHeightCapacity ? DL_GROW(r + 1) : diana->dataHeightCapacity);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+	}
+
+	diana->dataHeight = diana->dataHeight > (r + 1) ? diana->dataHeight : (r + 1);
+
+	if(diana->dataHeight > diana->dataHeightCapacity) {
+		if(diana->processing && !diana->reservedBytes) {
+			void **entityData;
+
+			if(diana->processingDataHeight >= diana->processingDataCapacity) {
+				unsigned int newProcessingDataCapacity = DL_GROW(diana->processingDataHeight + 1);
+				err = _realloc(diana, diana->processingData, sizeof(*diana->processingData) * diana->processingDataCapacity, sizeof(*diana->processingData) * newProcessingDataCapacity, (void **)&diana->processingData);
+				if(err != DL_ERROR_NONE) {
+					return err;
+				}
+				diana->processingDataCapacity = newProcessingDataCapacity;
+			}
+
+			entityData = diana->processingData + diana->processingDataHeight;
+			if(*entityData == NULL) {
+				err = _alignedMalloc(diana, diana->dataAlignment, diana->dataWidth, entityData);
+				if(err != DL_ERROR_NONE) {
+					return err;
+				}
+			} else {
+				memset(*entityData, 0, diana->dataWidth);
+			}
+
+			diana->processingDataHeight++;
+		} else {
+			err = _resizeData(diana, DL_GROW(diana->dataHeight));
+			if(err != DL_ERROR_NONE) {
+				return err;
+			}
+		}
+	}
+
+#if DL_HANDLES
+	// new rows, and ids skipped to get to r, start past every generation dropped
+	for(; i <= r; i++) {
+		*_generation(diana, _getEntityData(diana, i)) = diana->generationFloor;
+	}
+#endif
+
+#if DL_DELTA
+	_delta_touch(diana, r);
+#endif
+
+	return err;
+}
+
+static int _spawn(struct diana *diana, unsigned int * entity_ptr) {
+	unsigned int r, dataHeight = diana->dataHeight;
+	int err = DL_ERROR_NONE;
+
+	if(_sparseIntegerSet_isEmpty(diana, &diana->freeEntityIds)) {
+		r = diana->nextEntityId++;
+	} else {
+		r = _sparseIntegerSet_pop(diana, &diana->freeEntityIds);
+	}
+
+	// a row that could not be made leaves no entity behind
+	err = _allocateRow(diana, r);
+	if(err != DL_ERROR_NONE) {
+		diana->dataHeight = dataHeight;
+		if(r + 1 == diana->nextEntityId) {
+			diana->nextEntityId--;
+		} else {
+			_sparseIntegerSet_insert(diana, &diana->freeEntityIds, r);
+		}
+		return err;
+	}
+
+	*entity_ptr = r;
+
+	return err;
+}
+
+int diana_spawn(struct diana *diana, unsigned int * entity_ptr) {
+	int err;
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	err = _spawn(diana, entity_ptr);
+
+#if DL_RECORD
+	if(err == DL_ERROR_NONE && _record_op(diana, DL_RECORD_SPAWN)) {
+		_record_uint(diana, *entity_ptr);
+	}
+#endif
+
+	return err;
+}
+
+// buffer a signal into a set of added/enabled/disabled/deleted sets
+static int _signal(struct diana *diana, struct _sparseIntegerSet *added, struct _sparseIntegerSet *enabled, struct _sparseIntegerSet *disabled, struct _sparseIntegerSet *deleted, unsigned int entity, unsigned int signal) {
 	switch(signal) {
 	case DL_ENTITY_ADDED:
-		_sparseIntegerSet_insert(diana, &diana->added, entity);
-		_sparseIntegerSet_insert(diana, &diana->enabled, entity);
-		_sparseIntegerSet_delete(diana, &diana->disabled, entity);
-		_sparseIntegerSet_delete(diana, &diana->deleted, entity);
+		_sparseIntegerSet_insert(diana, added, entity);
+		_sparseIntegerSet_insert(diana, enabled, entity);
+		_sparseIntegerSet_delete(diana, disabled, entity);
+		_sparseIntegerSet_delete(diana, deleted, entity);
 		break;
 	case DL_ENTITY_ENABLED:
-		_sparseIntegerSet_insert(diana, &diana->enabled, entity);
-		_sparseIntegerSet_delete(diana, &diana->disabled, entity);
-		_sparseIntegerSet_delete(diana, &diana->deleted, entity);
+		_sparseIntegerSet_insert(diana, enabled, entity);
+		_sparseIntegerSet_delete(diana, disabled, entity);
+		_sparseIntegerSet_delete(diana, deleted, entity);
 		break;
 	case DL_ENTITY_DISABLED:
-		_sparseIntegerSet_delete(diana, &diana->enabled, entity);
-		_sparseIntegerSet_insert(diana, &diana->disabled, entity);
-		_sparseIntegerSet_delete(diana, &diana->deleted, entity);
+		_sparseIntegerSet_delete(diana, enabled, entity);
+		_sparseIntegerSet_insert(diana, disabled, entity);
+		_sparseIntegerSet_delete(diana, deleted, entity);
 		break;
 	case DL_ENTITY_DELETED:
-		_sparseIntegerSet_delete(diana, &diana->added, entity);
-		_sparseIntegerSet_delete(diana, &diana->enabled, entity);
-		_sparseIntegerSet_insert(diana, &diana->disabled, entity);
-		_sparseIntegerSet_insert(diana, &diana->deleted, entity);
+		_sparseIntegerSet_delete(diana, added, entity);
+		_sparseIntegerSet_delete(diana, enabled, entity);
+		_sparseIntegerSet_insert(diana, disabled, entity);
+		_sparseIntegerSet_insert(diana, deleted, entity);
 		break;
 	default:
-		err = DL_ERROR_INVALID_VALUE;
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return DL_ERROR_NONE;
+}
+
+static int _signalEntity(struct diana *diana, unsigned int entity, unsigned int signal) {
+	int err = _signal(diana, &diana->added, &diana->enabled, &diana->disabled, &diana->deleted, entity, signal);
+
+#if DL_DELTA
+	if(err == DL_ERROR_NONE) {
+		_delta_touch(diana, entity);
+		_signal(diana, &diana->deltaAdded, &diana->deltaEnabled, &diana->deltaDisabled, &diana->deltaDeleted, entity, signal);
+	}
+#endif
+
+	return err;
+}
+
+int diana_signal(struct diana *diana, unsigned int entity, unsigned int signal) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_SIGNAL)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, signal);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _signalEntity(diana, entity, signal);
+}
+
+static unsigned int _getComponentCount(struct diana *diana, unsigned int entity, unsigned int component) {
+	unsigned char *entityData = _getEntityData(diana, entity);
+	struct _component *c = diana->components + component;
+
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+		return bag->count;
+	}
+
+	return _signature_isSet(_getSignature(diana, entity), component);
+}
+
+static int _reserveSlotPointers(struct diana *diana, struct _component *c, unsigned int capacity) {
+	int err;
+
+	if(capacity <= c->dataCapacity) {
+		return DL_ERROR_NONE;
+	}
+
+	err = _realloc(diana, c->data, sizeof(void *) * c->dataCapacity, sizeof(void *) * capacity, (void **)&c->data);
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+	// a defragmentation pass that can not keep up starts over later
+	if(c->owners != NULL && _realloc(diana, c->owners, sizeof(unsigned int) * c->dataCapacity, sizeof(unsigned int) * capacity, (void **)&c->owners) != DL_ERROR_NONE) {
+		_endDefragment(diana, c);
+	}
+	c->dataCapacity = capacity;
+
+	// the free list pages for every slot
+	return _sparseIntegerSet_reserve(diana, &c->freeDataIndexes, capacity);
+}
+
+static int _reserveSlabs(struct diana *diana, struct _component *c, unsigned int numSlabs) {
+	int err;
+
+	if(numSlabs > c->slabCapacity) {
+		unsigned int slabCapacity = DL_GROW(c->slabCapacity) > numSlabs ? DL_GROW(c->slabCapacity) : numSlabs;
+		err = _realloc(diana, c->slabs, sizeof(void *) * c->slabCapacity, sizeof(void *) * slabCapacity, (void **)&c->slabs);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+		c->slabCapacity = slabCapacity;
+	}
+
+	while(c->numSlabs < numSlabs) {
+		err = _alignedMalloc(diana, c->alignment, c->stride * c->slabSlots, c->slabs + c->numSlabs);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+		c->numSlabs++;
+	}
+
+	return DL_ERROR_NONE;
+}
+
+// a slot past the last one, cut out of a new slab when the last one is full
+static int _newSlot(struct diana *diana, struct _component *c, unsigned int * index) {
+	unsigned int slab = c->nextDataIndex / c->slabSlots;
+	int err;
+
+	if(c->nextDataIndex >= c->dataCapacity) {
+		err = _reserveSlotPointers(diana, c, DL_GROW(c->nextDataIndex + 1));
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+	}
+
+	if(slab >= c->numSlabs) {
+		err = _reserveSlabs(diana, c, slab + 1);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+	}
+
+	*index = c->nextDataIndex++;
+	c->data[*index] = (unsigned char *)c->slabs[slab] + c->stride * (*index % c->slabSlots);
+
+	return DL_ERROR_NONE;
+}
+
+static int _getAComponentIndex(struct diana *diana, struct _component *c, unsigned int * index) {
+	if(_sparseIntegerSet_isEmpty(diana, &c->freeDataIndexes)) {
+		if((c->flags & DL_COMPONENT_LIMITED_BIT) && c->nextDataIndex >= (c->flags >> 3)) {
+			return DL_ERROR_FULL_COMPONENT;
+		}
+
+		return _newSlot(diana, c, index);
+	} else {
+		*index = _sparseIntegerSet_pop(diana, &c->freeDataIndexes);
+	}
+
+	return DL_ERROR_NONE;
+}
+
+// find or make room for instance i, *defined_ptr tells if it was there already
+static int _placeComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, void ** ptr, int * defined_ptr) {
+	unsigned char *entityData = _getEntityData(diana, entity);
+	struct _component *c = diana->components + component;
+	int defined = _signature_set(_getSignature(diana, entity), component);
+	void *componentData = NULL;
+	unsigned int err = DL_ERROR_NONE;
+
+#if DL_COMPUTE
+	if(c->compute) {
+		entityData[c->offset - 1] = !defined;
+	}
+#endif
+
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+		unsigned int index;
+
+		if(i >= bag->count) {
+			err = _getAComponentIndex(diana, c, &index);
+			if(err != DL_ERROR_NONE) {
+				return err;
+			}
+			if(c->owners != NULL) {
+				c->owners[index] = entity;
+			}
+
+			if(bag->count >= bag->capacity) {
+				unsigned int newCapacity = bag->capacity ? bag->capacity * 2 : 1;
+				err = _realloc(diana, bag->indexes, sizeof(unsigned int) * bag->capacity, sizeof(unsigned int) * newCapacity, (void **)&bag->indexes);
+				if(err != DL_ERROR_NONE) {
+					_sparseIntegerSet_insert(diana, &c->freeDataIndexes, index);
+					return err;
+				}
+				bag->capacity = newCapacity;
+			}
+			bag->indexes[i = bag->count++] = index;
+			defined = 0;
+		}
+
+		componentData = (void *)((unsigned char *)c->data[bag->indexes[i]]);
+	} else if(c->flags & DL_COMPONENT_INDEXED_BIT) {
+		unsigned int *index = (unsigned int *)(entityData + c->offset);
+
+		if(!defined) {
+			err = _getAComponentIndex(diana, c, index);
+			if(err != DL_ERROR_NONE) {
+				return err;
+			}
+			if(c->owners != NULL) {
+				c->owners[*index] = entity;
+			}
+		}
+
+		componentData = (void *)((unsigned char *)c->data[*index]);
+	} else {
+		componentData = (void *)(entityData + c->offset);
+	}
+
+#if DL_DELTA
+	_delta_change(diana, entity, component);
+#endif
+
+	*ptr = componentData;
+	*defined_ptr = defined;
+
+	return err;
+}
+
+static int _dropComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, int destroy);
+
+static int _setComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, const void * data) {
+	struct _component *c = diana->components + component;
+	void *componentData;
+	int defined;
+	int err = _placeComponentI(diana, entity, component, i, &componentData, &defined);
+
+	if(err != DL_ERROR_NONE || componentData == data) {
+		return err;
+	}
+
+	if(c->construct != NULL) {
+		// replacing is destroying and constructing again, a NULL data keeps what is there
+		if(defined && data == NULL) {
+			return err;
+		}
+		if(defined && c->destruct != NULL) {
+			c->destruct(diana, c->lifecycleUserData, componentData);
+		}
+		err = c->construct(diana, c->lifecycleUserData, componentData, data);
+		// nothing was made, the instance goes without being destroyed. a new one of
+		// a multiple component is the last
+		if(err != DL_ERROR_NONE) {
+			if(!defined && (c->flags & DL_COMPONENT_MULTIPLE_BIT)) {
+				i = _getComponentCount(diana, entity, component) - 1;
+			}
+			_dropComponentI(diana, entity, component, i, 0);
+		}
+	} else if(data != NULL) {
+		if(defined && c->destruct != NULL) {
+			c->destruct(diana, c->lifecycleUserData, componentData);
+		}
+		memcpy(componentData, data, c->size);
+	}
+
+	return err;
+}
+
+// room for a new instance that the caller constructs, a single component there already is destroyed
+static int _emplaceComponent(struct diana *diana, unsigned int entity, unsigned int component, void ** ptr) {
+	struct _component *c = diana->components + component;
+	unsigned int i = (c->flags & DL_COMPONENT_MULTIPLE_BIT) ? _getComponentCount(diana, entity, component) : 0;
+	int defined;
+	int err = _placeComponentI(diana, entity, component, i, ptr, &defined);
+
+	if(err == DL_ERROR_NONE && defined && c->destruct != NULL) {
+		c->destruct(diana, c->lifecycleUserData, *ptr);
+	}
+
+	return err;
+}
+
+static int _getComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, void ** ptr) {
+	unsigned char *entityData = _getEntityData(diana, entity);
+	struct _component *c = diana->components + component;
+	void *componentData = NULL;
+	int err = DL_ERROR_NONE;
+
+#if DL_COMPUTE
+	unsigned int calculate = 0;
+#endif
+
+	if(!_signature_isSet(_getSignature(diana, entity), component)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+#if DL_COMPUTE
+	if(diana->computingComponentStack) {
+		_sparseIntegerSet_insert(diana, &c->componentsToDirty, diana->computingComponentStack->component);
+	}
+
+	if(c->compute) {
+		if(entityData[c->offset - 1]) {
+			calculate = 1;
+			entityData[c->offset - 1] = 0;
+		}
+	}
+#endif
+
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+		if(i >= bag->count) {
+			return DL_ERROR_INVALID_VALUE;
+		}
+		componentData = (void *)((unsigned char *)c->data[bag->indexes[i]]);
+	} else if(c->flags & DL_COMPONENT_INDEXED_BIT) {
+		unsigned int *index = (unsigned int *)(entityData + c->offset);
+		if(*index == UINT_MAX) {
+			return err;
+		}
+		componentData = (void *)((unsigned char *)c->data[*index]);
+	} else {
+		componentData = (void *)(entityData + c->offset);
+	}
+
+#if DL_COMPUTE
+	if(calculate) {
+		struct _computingComponentStack ccs;
+#if DL_TRACE
+		unsigned long long traceBegin = _traceBegin(diana);
+#endif
+		ccs.previous = diana->computingComponentStack;
+		ccs.component = component;
+		diana->computingComponentStack = &ccs;
+
+		RECORD_ENTER(diana, DL_RECORD_COMPUTE, component, entity);
+		c->compute(diana, c->userData, entity, i, componentData);
+		RECORD_LEAVE(diana);
+
+		diana->computingComponentStack = ccs.previous;
+#if DL_TRACE
+		_trace(diana, c->name != NULL ? c->name : "compute", traceBegin);
+#endif
+	}
+#endif
+
+	*ptr = componentData;
+
+	return err;
+}
+
+// destroy is 0 for an instance that was never constructed
+static int _dropComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, int destroy) {
+	unsigned char *entityData = _getEntityData(diana, entity);
+	struct _component *c = diana->components + component;
+	int err = DL_ERROR_NONE;
+
+	if(!_signature_clear(_getSignature(diana, entity), component)) {
+		return err;
+	}
+
+#if DL_DELTA
+	_delta_change(diana, entity, component);
+#endif
+
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+		if(i < bag->count) {
+			if(destroy && c->destruct != NULL) {
+				c->destruct(diana, c->lifecycleUserData, c->data[bag->indexes[i]]);
+			}
+			_sparseIntegerSet_insert(diana, &c->freeDataIndexes, bag->indexes[i]);
+			memmove(bag->indexes + i, bag->indexes + i + 1, (bag->count - i - 1) * sizeof(unsigned int));
+			bag->count--;
+		}
+		// the component stays defined while instances remain
+		if(bag->count) {
+			_signature_set(_getSignature(diana, entity), component);
+		}
+		return err;
+	}
+
+	if(c->flags & DL_COMPONENT_INDEXED_BIT) {
+		unsigned int *index = (unsigned int *)(entityData + c->offset);
+		if(destroy && c->destruct != NULL) {
+			c->destruct(diana, c->lifecycleUserData, c->data[*index]);
+		}
+		_sparseIntegerSet_insert(diana, &c->freeDataIndexes, *index);
+		*index = 0;
+	} else if(destroy && c->destruct != NULL) {
+		c->destruct(diana, c->lifecycleUserData, entityData + c->offset);
+	}
+
+	return err;
+}
+
+static int _removeComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i) {
+	return _dropComponentI(diana, entity, component, i, 1);
+}
+
+int diana_clone(struct diana *diana, unsigned int parentEntity, unsigned int * entity_ptr) {
+	unsigned int newEntity, ci, cbi, cbn;
+	int err = DL_ERROR_NONE;
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && parentEntity >= diana->dataHeight) || (diana->processing && parentEntity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	err = _spawn(diana, &newEntity);
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
+
+	for(ci = 0; ci < diana->num_components; ci++) {
+		if(!_signature_isSet(_getSignature(diana, parentEntity), ci)) {
+			continue;
+		}
+
+		cbn = _getComponentCount(diana, parentEntity, ci);
+
+		for(cbi = 0; cbi < cbn; cbi++) {
+			void *cd = NULL;
+		  err = _getComponentI(diana, parentEntity, ci, cbi, &cd);
+			if(err != DL_ERROR_NONE) {
+				return err;
+			}
+			_setComponentI(diana, newEntity, ci, cbi, cd);
+		}
+	}
+
+	*entity_ptr = newEntity;
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_CLONE)) {
+		_record_uint(diana, parentEntity);
+		_record_uint(diana, newEntity);
+	}
+#endif
+
+	return err;
+}
+
+// single
+int diana_setComponent(struct diana *diana, unsigned int entity, unsigned int component, const void * data) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_SET_COMPONENT)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+		_record_data(diana, component, data);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _setComponentI(diana, entity, component, 0, data);
+}
+
+int diana_getComponent(struct diana *diana, unsigned int entity, unsigned int component, void ** ptr) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_GET_COMPONENT)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _getComponentI(diana, entity, component, 0, ptr);
+}
+
+#if DL_COMPUTE || DL_DELTA
+int diana_dirtyComponent(struct diana *diana, unsigned int entity, unsigned int component) {
+#if DL_COMPUTE
+	struct _component *c;
+	unsigned char *entityData;
+	unsigned int i, ci;
+#endif
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_DIRTY_COMPONENT)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+#if DL_COMPUTE
+	entityData = _getEntityData(diana, entity);
+	c = diana->components + component;
+
+	FOREACH_SPARSEINTSET(ci, i, &c->componentsToDirty) {
+		struct _component *c2 = diana->components + ci;
+		entityData[c2->offset - 1] = 1;
+	}
+#endif
+
+#if DL_DELTA
+	_delta_change(diana, entity, component);
+#endif
+
+	return DL_ERROR_NONE;
+}
+#endif
+
+int diana_removeComponent(struct diana *diana, unsigned int entity, unsigned int component) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_REMOVE_COMPONENT)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _removeComponentI(diana, entity, component, 0);
+}
+
+// multiple
+int diana_getComponentCount(struct diana *diana, unsigned int entity, unsigned int component, unsigned int * count_ptr) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_GET_COMPONENT_COUNT)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	*count_ptr = _getComponentCount(diana, entity, component);
+
+	return DL_ERROR_NONE;
+}
+
+int diana_appendComponent(struct diana *diana, unsigned int entity, unsigned int component, const void * data) {
+	struct _component *c;
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_APPEND_COMPONENT)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+		_record_data(diana, component, data);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	c = diana->components + component;
+
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		return _setComponentI(diana, entity, component, _getComponentCount(diana, entity, component), data);
+	} else {
+		return _setComponentI(diana, entity, component, 0, data);
+	}
+}
+
+int diana_emplaceComponent(struct diana *diana, unsigned int entity, unsigned int component, void ** ptr) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_EMPLACE_COMPONENT)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _emplaceComponent(diana, entity, component, ptr);
+}
+
+static int _removeComponents(struct diana *diana, unsigned int entity, unsigned int component) {
+	unsigned char *entityData = _getEntityData(diana, entity);
+	struct _component *c = diana->components + component;
+	unsigned int i;
+
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+		if(bag->count) {
+			for(i = 0; i < bag->count; i++) {
+				if(c->destruct != NULL) {
+					c->destruct(diana, c->lifecycleUserData, c->data[bag->indexes[i]]);
+				}
+				_sparseIntegerSet_insert(diana, &c->freeDataIndexes, bag->indexes[i]);
+			}
+			bag->count = 0;
+			_signature_clear(_getSignature(diana, entity), component);
+#if DL_DELTA
+			_delta_change(diana, entity, component);
+#endif
+		}
+		return DL_ERROR_NONE;
+	} else {
+		return _removeComponentI(diana, entity, component, 0);
+	}
+}
+
+// the components it has, found a word of its signature at a time
+static void _removeAllComponents(struct diana *diana, unsigned int entity) {
+	unsigned int w, word;
+
+	for(w = 0; w < diana->signatureWords; w++) {
+		// a copy, destruct hooks that spawn can move the signatures
+		word = _getSignature(diana, entity)[w];
+		while(word != 0) {
+			_removeComponents(diana, entity, w * DL_SIGNATURE_BITS + _signature_lowest(word));
+			word &= word - 1;
+		}
+	}
+}
+
+int diana_removeComponents(struct diana *diana, unsigned int entity, unsigned int component) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_REMOVE_COMPONENTS)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _removeComponents(diana, entity, component);
+}
+
+// low level
+int diana_setComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, const void * data) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_SET_COMPONENT_I)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+		_record_uint(diana, i);
+		_record_data(diana, component, data);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _setComponentI(diana, entity, component, i, data);
+}
+
+int diana_getComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, void ** ptr) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_GET_COMPONENT_I)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+		_record_uint(diana, i);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _getComponentI(diana, entity, component, i, ptr);
+}
+
+int diana_removeComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_REMOVE_COMPONENT_I)) {
+		_record_uint(diana, entity);
+		_record_uint(diana, component);
+		_record_uint(diana, i);
+	}
+#endif
+
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	return _removeComponentI(diana, entity, component, i);
+}
+
+#if DL_HANDLES
+// ============================================================================
+// handles
+int diana_getHandle(struct diana *diana, unsigned int entity, unsigned long long * handle_ptr) {
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(_sparseIntegerSet_contains(diana, &diana->freeEntityIds, entity)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	*handle_ptr = (unsigned long long)*_generation(diana, _getEntityData(diana, entity)) << 32 | entity;
+
+	return DL_ERROR_NONE;
+}
+
+// free ids are a generation ahead of any handle, the compare is all it takes
+int diana_resolveHandle(struct diana *diana, unsigned long long handle, unsigned int * entity_ptr) {
+	unsigned int entity = (unsigned int)handle;
+
+	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	if(*_generation(diana, _getEntityData(diana, entity)) != (unsigned int)(handle >> 32)) {
+		return DL_ERROR_INVALID_VALUE;
+	}
+
+	*entity_ptr = entity;
+
+	return DL_ERROR_NONE;
+}
+
+int diana_signalH(struct diana *diana, unsigned long long handle, unsigned int signal) {
+	unsigned int entity;
+	int err = diana_resolveHandle(diana, handle, &entity);
+	return err != DL_ERROR_NONE ? err : diana_signal(diana, entity, signal);
+}
+
+int diana_setComponentH(struct diana *diana, unsigned long long handle, unsigned int component, const void * data) {
+	unsigned int entity;
+	int err = diana_resolveHandle(diana, handle, &entity);
+	return err != DL_ERROR_NONE ? err : diana_setComponent(diana, entity, component, data);
+}
+
+int diana_getComponentH(struct diana *diana, unsigned long long handle, unsigned int component, void ** data_ptr) {
+	unsigned int entity;
+	int err = diana_resolveHandle(diana, handle, &entity);
+	return err != DL_ERROR_NONE ? err : diana_getComponent(diana, entity, component, data_ptr);
+}
+
+int diana_removeComponentH(struct diana *diana, unsigned long long handle, unsigned int component) {
+	unsigned int entity;
+	int err = diana_resolveHandle(diana, handle, &entity);
+	return err != DL_ERROR_NONE ? err : diana_removeComponent(diana, entity, component);
+}
+#endif
+
+// ============================================================================
+// STORAGE
+int diana_getStorage(struct diana *diana, struct diana_storage * storage) {
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
 	}
 
-	return err;
+	// rows spawned during processing are not in the table yet, they are not active either
+	storage->rows = diana->data;
+	storage->rowSize = diana->dataWidth;
+	storage->numRows = diana->dataHeight < diana->dataHeightCapacity ? diana->dataHeight : diana->dataHeightCapacity;
+	storage->signatures = diana->signatures;
+	storage->signatureWords = diana->signatureWords;
+	storage->active = diana->active.bytes;
+	storage->activeCapacity = diana->active.capacity;
+
+	return DL_ERROR_NONE;
 }
 
-static int _getAComponentIndex(struct diana *diana, struct _component *c, unsigned int * index) {
-	if(_sparseIntegerSet_isEmpty(diana, &c->freeDataIndexes)) {
-		if(c->flags & DL_COMPONENT_LIMITED_BIT) {
-			return DL_ERROR_FULL_COMPONENT;
-		}
+int diana_getComponentStorage(struct diana *diana, unsigned int component, struct diana_componentStorage * storage) {
+	struct _component *c;
 
-		*index = c->nextDataIndex++;
+	if(!diana->initialized) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
 
-		return _realloc(diana, c->data, sizeof(void *) * *index, sizeof(void *) * c->nextDataIndex, (void **)&c->data) ||
-		       _malloc(diana, c->size, (void **)&c->data[*index]);
-	} else {
-		*index = _sparseIntegerSet_pop(diana, &c->freeDataIndexes);
+	if(component >= diana->num_components) {
+		return DL_ERROR_INVALID_VALUE;
 	}
 
+	c = diana->components + component;
+
+	storage->size = c->size;
+	storage->flags = c->flags;
+	storage->offset = c->offset;
+	storage->slots = c->data;
+	storage->direct = !(c->flags & DL_COMPONENT_MULTIPLE_BIT);
+#if DL_COMPUTE
+	storage->direct = storage->direct && c->compute == NULL;
+#endif
+
 	return DL_ERROR_NONE;
 }
 
-static int _setComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, const void * data) {
+#if DL_DELTA
+// ============================================================================
+// DELTA
+// - every entity spawned, signaled or changed since the last delta
+// - components are tracked when set, appended, removed or dirtied
+// - changes made through a pointer from diana_getComponent need a diana_dirtyComponent
+// - layout: header, then per entity its id, signals and changed components
+#define DL_DELTA_MAGIC 0x31444c44
+
+// raw component data, without triggering a compute
+static void *_componentData(struct diana *diana, unsigned char *entityData, struct _component *c, unsigned int i) {
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
+		return c->data[bag->indexes[i]];
+	} else if(c->flags & DL_COMPONENT_INDEXED_BIT) {
+		return c->data[*(unsigned int *)(entityData + c->offset)];
+	}
+	return entityData + c->offset;
+}
+
+static int _delta_writeEntity(struct diana *diana, struct _buffer *b, unsigned int entity) {
 	unsigned char *entityData = _getEntityData(diana, entity);
-	struct _component *c = diana->components + component;
-	int defined = _bits_set(entityData, component);
-	void *componentData = NULL;
-	unsigned int err = DL_ERROR_NONE;
+	unsigned char signals = 0;
+	unsigned int ci, i, count, numComponents = 0;
+	size_t numComponentsPosition;
+	struct _component *c;
+	int err;
 
-#if DL_COMPUTE
-	if(c->compute) {
-		entityData[c->offset - 1] = !defined;
+	signals |= _sparseIntegerSet_contains(diana, &diana->deltaAdded, entity) << DL_ENTITY_ADDED;
+	signals |= _sparseIntegerSet_contains(diana, &diana->deltaEnabled, entity) << DL_ENTITY_ENABLED;
+	signals |= _sparseIntegerSet_contains(diana, &diana->deltaDisabled, entity) << DL_ENTITY_DISABLED;
+	signals |= _sparseIntegerSet_contains(diana, &diana->deltaDeleted, entity) << DL_ENTITY_DELETED;
+
+	if((err = _buffer_write(diana, b, &entity, sizeof(entity))) != DL_ERROR_NONE ||
+	   (err = _buffer_write(diana, b, &signals, sizeof(signals))) != DL_ERROR_NONE) {
+		return err;
 	}
-#endif
 
-	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
-		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
-		unsigned int index;
+	numComponentsPosition = b->size;
+	err = _buffer_write(diana, b, &numComponents, sizeof(numComponents));
+	if(err != DL_ERROR_NONE) {
+		return err;
+	}
 
-		if(i >= bag->count) {
-			err = _getAComponentIndex(diana, c, &index);
-			if(err != DL_ERROR_NONE) {
-				return err;
-			}
+	FOREACH_ARRAY(c, ci, diana->components, diana->num_components) {
+		if(!_denseIntegerSet_contains(diana, &c->deltaChanged, entity)) {
+			continue;
+		}
 
-			err = _realloc(diana, bag->indexes, sizeof(unsigned int) * bag->count, sizeof(unsigned int) * (bag->count + 1), (void **)&bag->indexes);
+		count = 0;
+		if(_signature_isSet(_getSignature(diana, entity), ci)) {
+			count = (c->flags & DL_COMPONENT_MULTIPLE_BIT) ? ((struct _componentBag *)(entityData + c->offset))->count : 1;
+		}
+
+		if((err = _buffer_write(diana, b, &ci, sizeof(ci))) != DL_ERROR_NONE ||
+		   (err = _buffer_write(diana, b, &count, sizeof(count))) != DL_ERROR_NONE) {
+			return err;
+		}
+		for(i = 0; i < count; i++) {
+			err = _buffer_write(diana, b, _componentData(diana, entityData, c, i), c->size);
 			if(err != DL_ERROR_NONE) {
 				return err;
 			}
-			bag->indexes[i = bag->count++] = index;
 		}
 
-		componentData = (void *)((unsigned char *)c->data[bag->indexes[i]]);
-	} else if(c->flags & DL_COMPONENT_INDEXED_BIT) {
-		unsigned int *index = (unsigned int *)(entityData + c->offset);
+		numComponents++;
+	}
 
-		if(!defined) {
-			err = _getAComponentIndex(diana, c, index);
-			if(err != DL_ERROR_NONE) {
-				return err;
-			}
+	memcpy(b->data + numComponentsPosition, &numComponents, sizeof(numComponents));
+
+	return DL_ERROR_NONE;
+}
+
+static void _delta_clear(struct diana *diana) {
+	unsigned int entity, i, ci;
+	struct _component *c;
+
+	FOREACH_SPARSEINTSET(entity, i, &diana->deltaEntities) {
+		FOREACH_ARRAY(c, ci, diana->components, diana->num_components) {
+			_denseIntegerSet_delete(diana, &c->deltaChanged, entity);
 		}
+	}
 
-		componentData = (void *)((unsigned char *)c->data[*index]);
+	_sparseIntegerSet_clear(diana, &diana->deltaEntities);
+	_sparseIntegerSet_clear(diana, &diana->deltaAdded);
+	_sparseIntegerSet_clear(diana, &diana->deltaEnabled);
+	_sparseIntegerSet_clear(diana, &diana->deltaDisabled);
+	_sparseIntegerSet_clear(diana, &diana->deltaDeleted);
+}
+
+// make a specific entity id live, used to mirror ids of another world
+static int _spawnAt(struct diana *diana, unsigned int entity) {
+	unsigned int i;
+
+	if(entity < diana->nextEntityId) {
+		if(!_sparseIntegerSet_delete(diana, &diana->freeEntityIds, entity)) {
+			return DL_ERROR_NONE;
+		}
 	} else {
-		componentData = (void *)(entityData + c->offset);
+		for(i = diana->nextEntityId; i < entity; i++) {
+			_sparseIntegerSet_insert(diana, &diana->freeEntityIds, i);
+		}
+		diana->nextEntityId = entity + 1;
 	}
 
-	if(data != NULL) {
-		memcpy(componentData, data, c->size);
+	return _allocateRow(diana, entity);
+}
+
+int diana_createDelta(struct diana *diana, void ** delta_ptr, size_t * size_ptr) {
+	struct _buffer b;
+	unsigned int header[3], entity, i;
+	int err = DL_ERROR_NONE;
+
+#if DL_RECORD
+	_record_op(diana, DL_RECORD_CREATE_DELTA);
+#endif
+
+	if(!diana->initialized || diana->processing || diana->lifecycleComponents) {
+		return DL_ERROR_INVALID_OPERATION;
 	}
 
-	return err;
+	memset(&b, 0, sizeof(b));
+
+	header[0] = DL_DELTA_MAGIC;
+	header[1] = diana->num_components;
+	header[2] = diana->deltaEntities.population;
+	err = _buffer_write(diana, &b, header, sizeof(header));
+
+	FOREACH_SPARSEINTSET(entity, i, &diana->deltaEntities) {
+		if(err != DL_ERROR_NONE) {
+			break;
+		}
+		err = _delta_writeEntity(diana, &b, entity);
+	}
+
+	if(err != DL_ERROR_NONE) {
+		_free(diana, b.data);
+		return err;
+	}
+
+	_delta_clear(diana);
+
+	*delta_ptr = b.data;
+	*size_ptr = b.size;
+
+	return DL_ERROR_NONE;
 }
 
-static int _getComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, void ** ptr) {
-	unsigned char *entityData = _getEntityData(diana, entity);
-	struct _component *c = diana->components + component;
-	void *componentData = NULL;
-	int err = DL_ERROR_NONE;
+int diana_applyDelta(struct diana *diana, const void * delta, size_t size) {
+	struct _reader r;
+	unsigned int magic, numComponents, numEntities, entity, component, count, n, i, j;
+	const void *ptr;
+	unsigned char signals;
+	struct _component *c;
+	int err;
 
-#if DL_COMPUTE
-	unsigned int calculate = 0;
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_APPLY_DELTA)) {
+		_record_uint(diana, size);
+		_record_bytes(diana, delta, size);
+	}
 #endif
 
-	if(!_bits_isSet(entityData, component)) {
+	if(!diana->initialized || diana->processing || diana->lifecycleComponents) {
+		return DL_ERROR_INVALID_OPERATION;
+	}
+
+	r.data = (const unsigned char *)delta;
+	r.size = size;
+	r.position = 0;
+
+	if((err = _reader_readUInt(&r, &magic)) != DL_ERROR_NONE ||
+	   (err = _reader_readUInt(&r, &numComponents)) != DL_ERROR_NONE ||
+	   (err = _reader_readUInt(&r, &numEntities)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	if(magic != DL_DELTA_MAGIC || numComponents != diana->num_components) {
 		return DL_ERROR_INVALID_VALUE;
 	}
 
+	for(n = 0; n < numEntities; n++) {
+		if((err = _reader_readUInt(&r, &entity)) != DL_ERROR_NONE ||
+		   (err = _reader_read(&r, &ptr, sizeof(signals))) != DL_ERROR_NONE ||
+		   (err = _reader_readUInt(&r, &numComponents)) != DL_ERROR_NONE) {
+			return err;
+		}
+		signals = *(const unsigned char *)ptr;
+
+		err = _spawnAt(diana, entity);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
+
+		for(i = 0; i < numComponents; i++) {
+			if((err = _reader_readUInt(&r, &component)) != DL_ERROR_NONE ||
+			   (err = _reader_readUInt(&r, &count)) != DL_ERROR_NONE) {
+				return err;
+			}
+
+			if(component >= diana->num_components) {
+				return DL_ERROR_INVALID_VALUE;
+			}
+			c = diana->components + component;
+
+			if(count > 1 && !(c->flags & DL_COMPONENT_MULTIPLE_BIT)) {
+				return DL_ERROR_INVALID_VALUE;
+			}
+
+			_removeComponents(diana, entity, component);
+
+			for(j = 0; j < count; j++) {
+				if((err = _reader_read(&r, &ptr, c->size)) != DL_ERROR_NONE ||
+				   (err = _setComponentI(diana, entity, component, j, ptr)) != DL_ERROR_NONE) {
+					return err;
+				}
+			}
+
 #if DL_COMPUTE
-	if(diana->computingComponentStack) {
-		_sparseIntegerSet_insert(diana, &c->componentsToDirty, diana->computingComponentStack->component);
-	}
+			// computed data is recomputed on this side when read
+			if(c->compute && count) {
+				_getEntityData(diana, entity)[c->offset - 1] = 1;
+			}
+#endif
+		}
 
-	if(c->compute) {
-		if(entityData[c->offset - 1]) {
-			calculate = 1;
-			entityData[c->offset - 1] = 0;
+		for(i = DL_ENTITY_ADDED; i <= DL_ENTITY_DELETED; i++) {
+			if(signals & (1 << i)) {
+				_signalEntity(diana, entity, i);
+			}
 		}
 	}
+
+	return DL_ERROR_NONE;
+}
+
+int diana_freeDelta(struct diana *diana, void * delta) {
+	return _free(diana, delta);
+}
 #endif
 
-	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
-		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
-		if(i >= bag->count) {
-			return DL_ERROR_INVALID_VALUE;
+// ============================================================================
+// CHECKPOINT
+// - a flat copy of the entity table, component slots, bags and all sets
+// - checkpoints keep their buffer, so rolling through a fixed ring of them stops allocating
+// - systems and managers are not told about a rollback, their own state is theirs to restore
+struct diana_checkpoint {
+	struct _buffer buffer;
+#if DL_RECORD
+	unsigned int recordId;
+#endif
+};
+
+static int _checkpoint_save(struct diana *diana, struct _buffer *b) {
+	unsigned int header[4], i, ci;
+	struct _component *c;
+	struct _system *system;
+	int err;
+
+	header[0] = diana->dataWidth;
+	header[1] = diana->dataHeight;
+	header[2] = diana->nextEntityId;
+	header[3] = diana->layouts;
+
+	if((err = _buffer_write(diana, b, header, sizeof(header))) != DL_ERROR_NONE ||
+	   (err = _buffer_write(diana, b, diana->data, (size_t)diana->dataWidth * diana->dataHeight)) != DL_ERROR_NONE ||
+	   (err = _buffer_write(diana, b, diana->signatures, sizeof(unsigned int) * diana->signatureWords * diana->dataHeight)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_save(diana, &diana->freeEntityIds, b)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_save(diana, &diana->added, b)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_save(diana, &diana->enabled, b)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_save(diana, &diana->disabled, b)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_save(diana, &diana->deleted, b)) != DL_ERROR_NONE ||
+	   (err = _denseIntegerSet_save(diana, &diana->active, b)) != DL_ERROR_NONE) {
+		return err;
+	}
+
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		err = _denseIntegerSet_save(diana, &system->entities, b);
+		if(err != DL_ERROR_NONE) {
+			return err;
 		}
-		componentData = (void *)((unsigned char *)c->data[bag->indexes[i]]);
-	} else if(c->flags & DL_COMPONENT_INDEXED_BIT) {
-		unsigned int *index = (unsigned int *)(entityData + c->offset);
-		if(*index == UINT_MAX) {
+	}
+
+	FOREACH_ARRAY(c, ci, diana->components, diana->num_components) {
+		if((err = _buffer_write(diana, b, &c->nextDataIndex, sizeof(c->nextDataIndex))) != DL_ERROR_NONE ||
+		   (err = _sparseIntegerSet_save(diana, &c->freeDataIndexes, b)) != DL_ERROR_NONE) {
 			return err;
 		}
-		componentData = (void *)((unsigned char *)c->data[*index]);
-	} else {
-		componentData = (void *)(entityData + c->offset);
+
+		for(i = 0; i < c->nextDataIndex; i++) {
+			if(c->data[i] == NULL) {
+				continue;
+			}
+			err = _buffer_write(diana, b, c->data[i], c->size);
+			if(err != DL_ERROR_NONE) {
+				return err;
+			}
+		}
+
+		if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+			for(i = 0; i < diana->dataHeight; i++) {
+				struct _componentBag *bag = (struct _componentBag *)(_getEntityData(diana, i) + c->offset);
+				err = _buffer_write(diana, b, bag->indexes, sizeof(unsigned int) * bag->count);
+				if(err != DL_ERROR_NONE) {
+					return err;
+				}
+			}
+		}
 	}
 
-#if DL_COMPUTE
-	if(calculate) {
-		struct _computingComponentStack ccs;
-		ccs.previous = diana->computingComponentStack;
-		ccs.component = component;
-		diana->computingComponentStack = &ccs;
+	return DL_ERROR_NONE;
+}
 
-		c->compute(diana, c->userData, entity, i, componentData);
+// everything that can fail happens here, before the world is touched: the reader
+// is walked to the end, tables, sets and slots grow to what the checkpoint needs,
+// and the bags of multiple components are allocated into *bags_ptr, numMultiple per row
+static int _checkpoint_prepare(struct diana *diana, struct _reader r, unsigned int ***bags_ptr) {
+	unsigned int header[4], nextDataIndex, numMultiple = 0, count, i, ci, m;
+	const unsigned char *rows;
+	const void *ptr;
+	unsigned int **bags = NULL;
+	struct _componentBag bag;
+	struct _component *c;
+	struct _system *system;
+	int err;
 
-		diana->computingComponentStack = ccs.previous;
+	if((err = _reader_read(&r, &ptr, sizeof(header))) != DL_ERROR_NONE) {
+		return err;
 	}
-#endif
+	memcpy(header, ptr, sizeof(header));
 
-	*ptr = componentData;
+	// rows laid out since are not the ones saved
+	if(header[0] != diana->dataWidth || header[3] != diana->layouts) {
+		return DL_ERROR_INVALID_VALUE;
+	}
 
-	return err;
-}
+	if((err = _reader_read(&r, (const void **)&rows, (size_t)diana->dataWidth * header[1])) != DL_ERROR_NONE ||
+	   (err = _reader_read(&r, &ptr, sizeof(unsigned int) * diana->signatureWords * header[1])) != DL_ERROR_NONE) {
+		return err;
+	}
 
-static int _removeComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i) {
-	unsigned char *entityData = _getEntityData(diana, entity);
-	struct _component *c = diana->components + component;
-	int err = DL_ERROR_NONE;
+	if(header[1] > diana->dataHeightCapacity && (err = _resizeData(diana, header[1])) != DL_ERROR_NONE) {
+		return err;
+	}
+	if(header[1] > diana->signatureCapacity && (err = _resizeSignatures(diana, header[1])) != DL_ERROR_NONE) {
+		return err;
+	}
 
-	if(!_bits_clear(entityData, component)) {
+	if((err = _sparseIntegerSet_prepareRestore(diana, &diana->freeEntityIds, &r, 0)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_prepareRestore(diana, &diana->added, &r, 0)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_prepareRestore(diana, &diana->enabled, &r, 0)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_prepareRestore(diana, &diana->disabled, &r, 0)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_prepareRestore(diana, &diana->deleted, &r, 0)) != DL_ERROR_NONE ||
+	   (err = _denseIntegerSet_prepareRestore(diana, &diana->active, &r)) != DL_ERROR_NONE) {
 		return err;
 	}
 
-	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
-		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
-		if(i >= bag->count) {
-			return err;
-		}
-		_sparseIntegerSet_insert(diana, &c->freeDataIndexes, bag->indexes[i]);
-		memcpy(bag->indexes + i, bag->indexes + i + 1, bag->count - i * sizeof(unsigned int));
-		err = _realloc(diana, bag->indexes, sizeof(unsigned int) * bag->count, sizeof(unsigned int) * (bag->count - 1), (void **)&bag->indexes);
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		err = _denseIntegerSet_prepareRestore(diana, &system->entities, &r);
 		if(err != DL_ERROR_NONE) {
 			return err;
 		}
-		bag->count--;
+	}
+
+#if DL_DELTA
+	// the next delta describes every entity
+	count = diana->dataHeight > header[1] ? diana->dataHeight : header[1];
+	if((err = _sparseIntegerSet_commit(diana, &diana->deltaEntities, count)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deltaAdded, count)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deltaEnabled, count)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deltaDisabled, count)) != DL_ERROR_NONE ||
+	   (err = _sparseIntegerSet_commit(diana, &diana->deltaDeleted, count)) != DL_ERROR_NONE) {
 		return err;
 	}
+#endif
 
-	if(c->flags & DL_COMPONENT_INDEXED_BIT) {
-		unsigned int *index = (unsigned int *)(entityData + c->offset);
-		_sparseIntegerSet_insert(diana, &c->freeDataIndexes, *index);
-		*index = 0;
+	FOREACH_ARRAY(c, ci, diana->components, diana->num_components) {
+		numMultiple += !!(c->flags & DL_COMPONENT_MULTIPLE_BIT);
+	}
+	if(numMultiple && header[1]) {
+		if((err = _malloc(diana, sizeof(unsigned int *) * numMultiple * header[1], (void **)&bags)) != DL_ERROR_NONE) {
+			return err;
+		}
+		memset(bags, 0, sizeof(unsigned int *) * numMultiple * header[1]);
+	}
+
+	m = 0;
+	FOREACH_ARRAY(c, ci, diana->components, diana->num_components) {
+		if((err = _reader_readUInt(&r, &nextDataIndex)) != DL_ERROR_NONE) {
+			break;
+		}
+
+		// slots handed out after the checkpoint go back to the free list
+		count = c->nextDataIndex > nextDataIndex ? c->nextDataIndex : nextDataIndex;
+		if((err = _sparseIntegerSet_prepareRestore(diana, &c->freeDataIndexes, &r, count)) != DL_ERROR_NONE ||
+		   (err = _reader_read(&r, &ptr, (size_t)c->size * nextDataIndex)) != DL_ERROR_NONE) {
+			break;
+		}
+		if(nextDataIndex > c->nextDataIndex &&
+		   ((err = _reserveSlotPointers(diana, c, nextDataIndex)) != DL_ERROR_NONE ||
+		    (err = _reserveSlabs(diana, c, (nextDataIndex + c->slabSlots - 1) / c->slabSlots)) != DL_ERROR_NONE)) {
+			break;
+		}
+
+		if(!(c->flags & DL_COMPONENT_MULTIPLE_BIT)) {
+			continue;
+		}
+		for(i = 0; i < header[1] && err == DL_ERROR_NONE; i++) {
+			memcpy(&bag, rows + (size_t)diana->dataWidth * i + c->offset, sizeof(bag));
+			if(bag.count == 0) {
+				continue;
+			}
+			if((err = _reader_read(&r, &ptr, sizeof(unsigned int) * bag.count)) == DL_ERROR_NONE &&
+			   (err = _malloc(diana, sizeof(unsigned int) * bag.count, (void **)&bags[numMultiple * i + m])) == DL_ERROR_NONE) {
+				memcpy(bags[numMultiple * i + m], ptr, sizeof(unsigned int) * bag.count);
+			}
+		}
+		if(err != DL_ERROR_NONE) {
+			break;
+		}
+		m++;
+	}
+
+	if(err != DL_ERROR_NONE) {
+		for(i = 0; bags != NULL && i < numMultiple * header[1]; i++) {
+			_free(diana, bags[i]);
+		}
+		_free(diana, bags);
+		return err;
 	}
 
-	return err;
+	*bags_ptr = bags;
+
+	return DL_ERROR_NONE;
 }
 
-int diana_clone(struct diana *diana, unsigned int parentEntity, unsigned int * entity_ptr) {
-	unsigned int newEntity, ci, cbi, cbn;
-	unsigned char *parentEntityData;
-	int err = DL_ERROR_NONE;
+// a failed restore leaves the world as it was, past _checkpoint_prepare nothing can fail
+static int _checkpoint_restore(struct diana *diana, struct _reader *r) {
+	unsigned int header[4], nextDataIndex = 0, oldDataHeight = diana->dataHeight, numMultiple = 0, i, ci, m;
+	unsigned int **bags = NULL;
+	const void *ptr;
+	struct _component *c;
+	struct _system *system;
+	int err;
 
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+	if((err = _checkpoint_prepare(diana, *r, &bags)) != DL_ERROR_NONE) {
+		return err;
 	}
 
-	if((!diana->processing && parentEntity >= diana->dataHeight) || (diana->processing && parentEntity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
+	_reader_read(r, &ptr, sizeof(header));
+	memcpy(header, ptr, sizeof(header));
+
+	// the rows about to be overwritten own their bags, and slots change hands
+	FOREACH_ARRAY(c, ci, diana->components, diana->num_components) {
+		_endDefragment(diana, c);
+		if(!(c->flags & DL_COMPONENT_MULTIPLE_BIT)) {
+			continue;
+		}
+		numMultiple++;
+		for(i = 0; i < diana->dataHeight; i++) {
+			struct _componentBag *bag = (struct _componentBag *)(_getEntityData(diana, i) + c->offset);
+			_free(diana, bag->indexes);
+			bag->indexes = NULL;
+			bag->count = 0;
+			bag->capacity = 0;
+		}
 	}
 
-	err = diana_spawn(diana, &newEntity);
-	if(err != DL_ERROR_NONE) {
-		return err;
+	if(diana->dataHeight > header[1]) {
+#if DL_HANDLES
+		_dropGenerations(diana, header[1], diana->dataHeight);
+#endif
+		memset((unsigned char *)diana->data + diana->dataWidth * header[1], 0, diana->dataWidth * (diana->dataHeight - header[1]));
+		memset(_getSignature(diana, header[1]), 0, sizeof(unsigned int) * diana->signatureWords * (diana->dataHeight - header[1]));
+	}
+
+	_reader_read(r, &ptr, (size_t)diana->dataWidth * header[1]);
+	if(header[1]) {
+		memcpy(diana->data, ptr, (size_t)diana->dataWidth * header[1]);
 	}
+	_reader_read(r, &ptr, sizeof(unsigned int) * diana->signatureWords * header[1]);
+	if(header[1]) {
+		memcpy(diana->signatures, ptr, sizeof(unsigned int) * diana->signatureWords * header[1]);
+	}
+	diana->dataHeight = header[1];
+	diana->nextEntityId = header[2];
 
-	parentEntityData = _getEntityData(diana, parentEntity);
+	_sparseIntegerSet_restore(diana, &diana->freeEntityIds, r);
+	_sparseIntegerSet_restore(diana, &diana->added, r);
+	_sparseIntegerSet_restore(diana, &diana->enabled, r);
+	_sparseIntegerSet_restore(diana, &diana->disabled, r);
+	_sparseIntegerSet_restore(diana, &diana->deleted, r);
+	_denseIntegerSet_restore(diana, &diana->active, r);
 
-	for(ci = 0; ci < diana->num_components; ci++) {
-		if(!_bits_isSet(parentEntityData, ci)) {
-			continue;
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		_denseIntegerSet_restore(diana, &system->entities, r);
+	}
+
+	m = 0;
+	FOREACH_ARRAY(c, ci, diana->components, diana->num_components) {
+		_reader_readUInt(r, &nextDataIndex);
+
+		while(c->nextDataIndex < nextDataIndex) {
+			unsigned int index;
+			_newSlot(diana, c, &index);
 		}
 
-		err = diana_getComponentCount(diana, parentEntity, ci, &cbn);
-		if(err != DL_ERROR_NONE) {
-			return err;
+		_sparseIntegerSet_restore(diana, &c->freeDataIndexes, r);
+		for(i = nextDataIndex; i < c->nextDataIndex; i++) {
+			_sparseIntegerSet_insert(diana, &c->freeDataIndexes, i);
 		}
 
-		for(cbi = 0; cbi < cbn; cbi++) {
-			void *cd = NULL;
-		  err = _getComponentI(diana, parentEntity, ci, cbi, &cd);
-			if(err != DL_ERROR_NONE) {
-				return err;
+		for(i = 0; i < nextDataIndex; i++) {
+			_reader_read(r, &ptr, c->size);
+			memcpy(c->data[i], ptr, c->size);
+		}
+
+		if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+			for(i = 0; i < diana->dataHeight; i++) {
+				struct _componentBag *bag = (struct _componentBag *)(_getEntityData(diana, i) + c->offset);
+				bag->indexes = bags[numMultiple * i + m];
+				bag->capacity = bag->count;
+				_reader_read(r, &ptr, sizeof(unsigned int) * bag->count);
 			}
-			_setComponentI(diana, newEntity, ci, cbi, cd);
+			m++;
 		}
 	}
 
-	*entity_ptr = newEntity;
+	_free(diana, bags);
 
-	return err;
+#if DL_DELTA
+	// anything may have changed, so the next delta describes every entity
+	for(i = 0; i < oldDataHeight || i < diana->dataHeight; i++) {
+		for(ci = 0; ci < diana->num_components; ci++) {
+			_delta_change(diana, i, ci);
+		}
+		if(i >= diana->nextEntityId || _sparseIntegerSet_contains(diana, &diana->freeEntityIds, i)) {
+			_signal(diana, &diana->deltaAdded, &diana->deltaEnabled, &diana->deltaDisabled, &diana->deltaDeleted, i, DL_ENTITY_DELETED);
+		} else if(i < diana->active.capacity && _bits_isSet(diana->active.bytes, i)) {
+			_signal(diana, &diana->deltaAdded, &diana->deltaEnabled, &diana->deltaDisabled, &diana->deltaDeleted, i, DL_ENTITY_ENABLED);
+		} else {
+			_signal(diana, &diana->deltaAdded, &diana->deltaEnabled, &diana->deltaDisabled, &diana->deltaDeleted, i, DL_ENTITY_DISABLED);
+		}
+	}
+#else
+	(void)oldDataHeight;
+#endif
+
+	return DL_ERROR_NONE;
 }
 
-// single
-int diana_setComponent(struct diana *diana, unsigned int entity, unsigned int component, const void * data) {
-	if(!diana->initialized) {
+int diana_checkpoint(struct diana *diana, struct diana_checkpoint ** checkpoint_ptr) {
+	struct diana_checkpoint *checkpoint = *checkpoint_ptr;
+	int err;
+
+	if(!diana->initialized || diana->processing || diana->lifecycleComponents) {
 		return DL_ERROR_INVALID_OPERATION;
 	}
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
+	if(checkpoint == NULL) {
+		err = _malloc(diana, sizeof(*checkpoint), (void **)&checkpoint);
+		if(err != DL_ERROR_NONE) {
+			return err;
+		}
 	}
 
-	if(component >= diana->num_components) {
-		return DL_ERROR_INVALID_VALUE;
+	checkpoint->buffer.size = 0;
+
+	err = _checkpoint_save(diana, &checkpoint->buffer);
+	if(err != DL_ERROR_NONE) {
+		if(*checkpoint_ptr == NULL) {
+			_free(diana, checkpoint->buffer.data);
+			_free(diana, checkpoint);
+		}
+		return err;
 	}
 
-	return _setComponentI(diana, entity, component, 0, data);
+	*checkpoint_ptr = checkpoint;
+
+#if DL_RECORD
+	if(checkpoint->recordId == 0) {
+		checkpoint->recordId = ++diana->recordCheckpoints;
+	}
+	if(_record_op(diana, DL_RECORD_CHECKPOINT)) {
+		_record_uint(diana, checkpoint->recordId);
+	}
+#endif
+
+	return DL_ERROR_NONE;
 }
 
-int diana_getComponent(struct diana *diana, unsigned int entity, unsigned int component, void ** ptr) {
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+int diana_rollback(struct diana *diana, struct diana_checkpoint * checkpoint) {
+	struct _reader r;
+
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_ROLLBACK)) {
+		_record_uint(diana, checkpoint != NULL ? checkpoint->recordId : 0);
 	}
+#endif
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
+	if(!diana->initialized || diana->processing || diana->lifecycleComponents) {
+		return DL_ERROR_INVALID_OPERATION;
 	}
 
-	if(component >= diana->num_components) {
+	if(checkpoint == NULL) {
 		return DL_ERROR_INVALID_VALUE;
 	}
 
-	return _getComponentI(diana, entity, component, 0, ptr);
-}
+	r.data = checkpoint->buffer.data;
+	r.size = checkpoint->buffer.size;
+	r.position = 0;
 
-#if DL_COMPUTE
-int diana_dirtyComponent(struct diana *diana, unsigned int entity, unsigned int component) {
-	struct _component *c;
-	unsigned char *entityData;
-	unsigned int i, ci;
+	return _checkpoint_restore(diana, &r);
+}
 
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+int diana_freeCheckpoint(struct diana *diana, struct diana_checkpoint * checkpoint) {
+#if DL_RECORD
+	if(_record_op(diana, DL_RECORD_FREE_CHECKPOINT)) {
+		_record_uint(diana, checkpoint != NULL ? checkpoint->recordId : 0);
 	}
+#endif
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
+	if(checkpoint != NULL) {
+		_free(diana, checkpoint->buffer.data);
+		_free(diana, checkpoint);
 	}
+	return DL_ERROR_NONE;
+}
 
-	if(component >= diana->num_components) {
+#if DL_STATS
+// ============================================================================
+// STATS
+int diana_getStats(struct diana *diana, struct diana_stats * stats) {
+	*stats = diana->stats;
+#if DL_PERF_EVENT
+	stats->perfCounters = diana->perfCounters;
+#endif
+	return DL_ERROR_NONE;
+}
+
+int diana_getSystemStats(struct diana *diana, unsigned int system, struct diana_systemStats * stats) {
+	if(system >= diana->num_systems) {
 		return DL_ERROR_INVALID_VALUE;
 	}
 
-	entityData = _getEntityData(diana, entity);
-	c = diana->components + component;
+	*stats = diana->systems[system].stats;
 
-	FOREACH_SPARSEINTSET(ci, i, &c->componentsToDirty) {
-		struct _component *c2 = diana->components + ci;
-		entityData[c2->offset - 1] = 1;
+	return DL_ERROR_NONE;
+}
+
+int diana_resetStats(struct diana *diana) {
+	struct _system *system;
+	unsigned int i;
+
+	memset(&diana->stats, 0, sizeof(diana->stats));
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		memset(&system->stats, 0, sizeof(system->stats));
 	}
 
 	return DL_ERROR_NONE;
 }
 #endif
 
-int diana_removeComponent(struct diana *diana, unsigned int entity, unsigned int component) {
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+// ============================================================================
+// MEMORY
+static void _componentMemoryStats(struct diana *diana, struct _component *c, struct diana_componentMemoryStats * stats) {
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->slotCapacity = c->dataCapacity;
+	stats->freeSlots = c->freeDataIndexes.population;
+	stats->slots = sizeof(void *) * (c->dataCapacity + c->slabCapacity) + c->stride * c->slabSlots * c->numSlabs;
+	if(c->owners != NULL) {
+		stats->slots += sizeof(unsigned int) * c->dataCapacity;
 	}
+	stats->freeSlotIds = _sparseIntegerSet_bytes(&c->freeDataIndexes);
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
+	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
+		for(i = 0; i < diana->dataHeight; i++) {
+			struct _componentBag *bag = (struct _componentBag *)(_getEntityData(diana, i) + c->offset);
+			stats->bags += sizeof(unsigned int) * bag->capacity;
+		}
 	}
 
-	if(component >= diana->num_components) {
-		return DL_ERROR_INVALID_VALUE;
+#if DL_COMPUTE
+	stats->compute = _sparseIntegerSet_bytes(&c->componentsToDirty);
+#endif
+#if DL_DELTA
+	stats->delta = _denseIntegerSet_bytes(&c->deltaChanged);
+#endif
+
+	stats->total = sizeof(*c) + stats->slots + stats->freeSlotIds + stats->bags + stats->compute + stats->delta;
+	if(c->name != NULL) {
+		stats->total += strlen(c->name) + 1;
 	}
+}
 
-	return _removeComponentI(diana, entity, component, 0);
+static void _systemMemoryStats(struct diana *diana, struct _system *system, struct diana_systemMemoryStats * stats) {
+	memset(stats, 0, sizeof(*stats));
+
+	stats->entities = _denseIntegerSet_bytes(&system->entities);
+	stats->watches = _sparseIntegerSet_bytes(&system->watch) + _sparseIntegerSet_bytes(&system->exclude);
+	if(system->match != NULL) {
+		stats->watches += sizeof(unsigned int) * diana->signatureWords * 2;
+	}
+
+	stats->total = sizeof(*system) + stats->entities + stats->watches;
+	if(system->name != NULL) {
+		stats->total += strlen(system->name) + 1;
+	}
 }
 
-// multiple
-int diana_getComponentCount(struct diana *diana, unsigned int entity, unsigned int component, unsigned int * count_ptr) {
-	unsigned char *entityData;
+int diana_getMemoryStats(struct diana *diana, struct diana_memoryStats * stats) {
+	struct diana_componentMemoryStats componentStats;
+	struct diana_systemMemoryStats systemStats;
 	struct _component *c;
+	struct _system *system;
+	struct _manager *manager;
+	unsigned int i;
 
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+	memset(stats, 0, sizeof(*stats));
+
+	stats->entityWidth = diana->dataWidth;
+	stats->entityHeight = diana->dataHeight;
+	stats->entityCapacity = diana->dataHeightCapacity;
+	stats->entityTable = (size_t)diana->dataWidth * diana->dataHeightCapacity;
+	stats->freeEntities = diana->freeEntityIds.population;
+	stats->processingData = sizeof(void *) * diana->processingDataCapacity;
+	for(i = 0; i < diana->processingDataCapacity; i++) {
+		if(diana->processingData[i] != NULL) {
+			stats->processingData += diana->dataWidth;
+		}
 	}
+	stats->signatures = sizeof(unsigned int) * diana->signatureWords * diana->signatureCapacity;
+
+	stats->freeEntityIds = _sparseIntegerSet_bytes(&diana->freeEntityIds);
+	stats->signals = _sparseIntegerSet_bytes(&diana->added) +
+	                 _sparseIntegerSet_bytes(&diana->enabled) +
+	                 _sparseIntegerSet_bytes(&diana->disabled) +
+	                 _sparseIntegerSet_bytes(&diana->deleted);
+	stats->active = _denseIntegerSet_bytes(&diana->active);
+#if DL_DELTA
+	stats->delta = _sparseIntegerSet_bytes(&diana->deltaEntities) +
+	               _sparseIntegerSet_bytes(&diana->deltaAdded) +
+	               _sparseIntegerSet_bytes(&diana->deltaEnabled) +
+	               _sparseIntegerSet_bytes(&diana->deltaDisabled) +
+	               _sparseIntegerSet_bytes(&diana->deltaDeleted);
+#endif
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
+	FOREACH_ARRAY(c, i, diana->components, diana->num_components) {
+		_componentMemoryStats(diana, c, &componentStats);
+		stats->components += componentStats.total;
 	}
 
-	if(component >= diana->num_components) {
-		return DL_ERROR_INVALID_VALUE;
+	FOREACH_ARRAY(system, i, diana->systems, diana->num_systems) {
+		_systemMemoryStats(diana, system, &systemStats);
+		stats->systems += systemStats.total;
 	}
 
-	entityData = _getEntityData(diana, entity);
-	c = diana->components + component;
-
-	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
-		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
-		*count_ptr = bag->count;
-	} else {
-		*count_ptr = _bits_isSet(entityData, component);
+	FOREACH_ARRAY(manager, i, diana->managers, diana->num_managers) {
+		stats->managers += sizeof(*manager);
+		if(manager->name != NULL) {
+			stats->managers += strlen(manager->name) + 1;
+		}
 	}
 
+	stats->total = sizeof(*diana) + stats->entityTable + stats->processingData + stats->signatures + stats->freeEntityIds +
+	               stats->signals + stats->active + stats->delta + stats->components + stats->systems + stats->managers;
+
 	return DL_ERROR_NONE;
 }
 
-int diana_appendComponent(struct diana *diana, unsigned int entity, unsigned int component, const void * data) {
-	struct _component *c;
-
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
-	}
-
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+int diana_getComponentMemoryStats(struct diana *diana, unsigned int component, struct diana_componentMemoryStats * stats) {
+	if(component >= diana->num_components) {
 		return DL_ERROR_INVALID_VALUE;
 	}
 
-	if(component >= diana->num_components) {
+	_componentMemoryStats(diana, diana->components + component, stats);
+
+	return DL_ERROR_NONE;
+}
+
+int diana_getSystemMemoryStats(struct diana *diana, unsigned int system, struct diana_systemMemoryStats * stats) {
+	if(system >= diana->num_systems) {
 		return DL_ERROR_INVALID_VALUE;
 	}
 
-	c = diana->components + component;
+	_systemMemoryStats(diana, diana->systems + system, stats);
 
-	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
-		unsigned int cc = 0;
-		diana_getComponentCount(diana, entity, component, &cc);
-		return _setComponentI(diana, entity, component, cc, data);
-	} else {
-		return _setComponentI(diana, entity, component, 0, data);
-	}
+	return DL_ERROR_NONE;
 }
 
-int diana_removeComponents(struct diana *diana, unsigned int entity, unsigned int component) {
-	unsigned char *entityData;
-	struct _component *c;
-	unsigned int i;
-
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+#if DL_TRACE
+// ============================================================================
+// TRACE
+// - dumped in the chrome trace event json array format
+// - the closing ] is optional in that format, so dumps can append to the same file
+int diana_traceStart(struct diana *diana, unsigned int capacity, unsigned int id) {
+	unsigned int powerOfTwo = 1;
+	int err;
+
+	// the ring is a power of two, past 2^31 there is none to round up to
+	if(capacity > 1u << 31) {
+		return DL_ERROR_INVALID_VALUE;
 	}
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
+	while(powerOfTwo < capacity) {
+		powerOfTwo <<= 1;
 	}
 
-	if(component >= diana->num_components) {
-		return DL_ERROR_INVALID_VALUE;
+	diana_traceStop(diana);
+
+	err = _malloc(diana, sizeof(*diana->traceEvents) * powerOfTwo, (void **)&diana->traceEvents);
+	if(err != DL_ERROR_NONE) {
+		return err;
 	}
 
-	entityData = _getEntityData(diana, entity);
-	c = diana->components + component;
+	diana->traceCapacity = powerOfTwo;
+	diana->traceId = id;
+	diana->traceHead = 0;
 
-	if(c->flags & DL_COMPONENT_MULTIPLE_BIT) {
-		struct _componentBag *bag = (struct _componentBag *)(entityData + c->offset);
-		if(bag->count) {
-			for(i = 0; i < bag->count; i++) {
-				_sparseIntegerSet_insert(diana, &c->freeDataIndexes, bag->indexes[i]);
-			}
-			bag->count = 0;
-			diana->free(bag->indexes);
-			bag->indexes = NULL;
+	return DL_ERROR_NONE;
+}
+
+int diana_traceStop(struct diana *diana) {
+	_free(diana, diana->traceEvents);
+	diana->traceEvents = NULL;
+	diana->traceCapacity = 0;
+	diana->traceHead = 0;
+	return DL_ERROR_NONE;
+}
+
+static void _traceWriteString(FILE *f, const char *s) {
+	fputc('"', f);
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\') {
+			fputc('\\', f);
+		}
+		if((unsigned char)*s >= 0x20) {
+			fputc(*s, f);
 		}
-		return DL_ERROR_NONE;
-	} else {
-		return _removeComponentI(diana, entity, component, 0);
 	}
+	fputc('"', f);
 }
 
-// low level
-int diana_setComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, const void * data) {
-	if(!diana->initialized) {
+int diana_traceDump(struct diana *diana, const char *filename) {
+	unsigned long long n, first;
+	struct _traceEvent *event;
+	int empty;
+	FILE *f;
+
+	if(diana->traceEvents == NULL) {
 		return DL_ERROR_INVALID_OPERATION;
 	}
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
+	f = fopen(filename, "a");
+	if(f == NULL) {
 		return DL_ERROR_INVALID_VALUE;
 	}
 
-	if(component >= diana->num_components) {
-		return DL_ERROR_INVALID_VALUE;
+	fseek(f, 0, SEEK_END);
+	empty = ftell(f) == 0;
+
+	fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"diana %u\"}}", empty ? "[\n" : ",\n", diana->traceId, diana->traceId);
+
+	first = diana->traceHead > diana->traceCapacity ? diana->traceHead - diana->traceCapacity : 0;
+	for(n = first; n < diana->traceHead; n++) {
+		event = diana->traceEvents + (n & (diana->traceCapacity - 1));
+		fprintf(f, ",\n{\"name\":");
+		_traceWriteString(f, event->name);
+		fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+			diana->traceId, event->begin / 1000.0, (event->end - event->begin) / 1000.0, event->frame);
 	}
 
-	return _setComponentI(diana, entity, component, i, data);
+	diana->traceHead = 0;
+
+	return fclose(f) == 0 ? DL_ERROR_NONE : DL_ERROR_INVALID_VALUE;
 }
+#endif
 
-int diana_getComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, void ** ptr) {
-	if(!diana->initialized) {
+#if DL_RECORD
+// ============================================================================
+// RECORD
+int diana_recordStart(struct diana *diana, const char *filename) {
+	int err;
+
+	// a replay has to create the same components and systems
+	if(diana->recordFile != NULL || diana->initialized || diana->num_components || diana->num_systems || diana->num_managers) {
 		return DL_ERROR_INVALID_OPERATION;
 	}
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
+	err = _malloc(diana, DL_RECORD_BUFFER, (void **)&diana->recordBuffer);
+	if(err != DL_ERROR_NONE) {
+		return err;
 	}
 
-	if(component >= diana->num_components) {
+	diana->recordFile = fopen(filename, "wb");
+	if(diana->recordFile == NULL) {
+		_free(diana, diana->recordBuffer);
+		diana->recordBuffer = NULL;
 		return DL_ERROR_INVALID_VALUE;
 	}
 
-	return _getComponentI(diana, entity, component, i, ptr);
+	diana->recordSize = 0;
+	diana->recordDepth = 0;
+	_record_bytes(diana, "DLR1", 4);
+
+	return DL_ERROR_NONE;
 }
 
-int diana_removeComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i) {
-	if(!diana->initialized) {
-		return DL_ERROR_INVALID_OPERATION;
+int diana_recordStop(struct diana *diana) {
+	if(diana->recordFile == NULL) {
+		return DL_ERROR_NONE;
 	}
 
-	if((!diana->processing && entity >= diana->dataHeight) || (diana->processing && entity >= diana->dataHeightCapacity + diana->processingDataHeight)) {
-		return DL_ERROR_INVALID_VALUE;
-	}
+	_record_flush(diana);
+	fclose(diana->recordFile);
+	_free(diana, diana->recordBuffer);
 
-	if(component >= diana->num_components) {
-		return DL_ERROR_INVALID_VALUE;
-	}
+	diana->recordFile = NULL;
+	diana->recordBuffer = NULL;
+	diana->recordDepth = 0;
 
-	return _removeComponentI(diana, entity, component, i);
+	return DL_ERROR_NONE;
 }
+#endif
@@ -13,6 +13,34 @@ extern "C" {
 #define DL_COMPUTE 1
 #endif
 
+#ifndef DL_DELTA
+#define DL_DELTA 0
+#endif
+
+#ifndef DL_STATS
+#define DL_STATS 0
+#endif
+
+#ifndef DL_TRACE
+#define DL_TRACE 0
+#endif
+
+#ifndef DL_RECORD
+#define DL_RECORD 0
+#endif
+
+#ifndef DL_PERF
+#define DL_PERF 0
+#endif
+
+#ifndef DL_HANDLES
+#define DL_HANDLES 0
+#endif
+
+#if DL_PERF && !DL_STATS
+#error "DL_PERF adds to the stats, it needs DL_STATS"
+#endif
+
 #include <stddef.h>
 
 // errors
@@ -28,11 +56,15 @@ enum {
 #define DL_COMPONENT_INDEXED_BIT  1
 #define DL_COMPONENT_MULTIPLE_BIT 2
 #define DL_COMPONENT_LIMITED_BIT  4
+// moves between the row and slots as the share of entities using it changes, not
+// for multiple or limited components. high so it stays clear of the limit
+#define DL_COMPONENT_ADAPTIVE_BIT 0x80000000u
 
 #define DL_COMPONENT_FLAG_INLINE     0
 #define DL_COMPONENT_FLAG_INDEXED    DL_COMPONENT_INDEXED_BIT
 #define DL_COMPONENT_FLAG_MULTIPLE   (DL_COMPONENT_INDEXED_BIT | DL_COMPONENT_MULTIPLE_BIT)
 #define DL_COMPONENT_FLAG_LIMITED(X) (DL_COMPONENT_INDEXED_BIT | DL_COMPONENT_LIMITED_BIT | ((X) << 3))
+#define DL_COMPONENT_FLAG_ADAPTIVE   DL_COMPONENT_ADAPTIVE_BIT
 
 // system flags
 #define DL_SYSTEM_PASSIVE_BIT 1
@@ -57,6 +89,22 @@ struct diana;
 
 int allocate_diana(void *(*malloc)(size_t), void (*free)(void *), struct diana **);
 
+// an allocator with a context, for arenas and memory pools per world
+struct diana_allocator {
+	void *(*malloc)(void *userData, size_t size);
+	void (*free)(void *userData, void *ptr);
+
+	// optional, without it growing is malloc, memcpy and free
+	void *(*realloc)(void *userData, void *ptr, size_t oldSize, size_t newSize);
+
+	// optional, alignment is a power of two and the block is freed with free
+	void *(*alignedAlloc)(void *userData, size_t alignment, size_t size);
+
+	void *userData;
+};
+
+int allocate_diana_withAllocator(const struct diana_allocator *allocator, struct diana **);
+
 int diana_free(struct diana *);
 
 // ============================================================================
@@ -77,6 +125,30 @@ int diana_createComponent(
 int diana_componentCompute(struct diana *diana, unsigned int component, void (*compute)(struct diana *, void *, unsigned int entity, unsigned int index, void *), void *userData);
 #endif
 
+// reserve address space for this many entities when initializing, where mmap exists, so
+// the entity table grows in place: rows never move, inline components keep their address
+// across spawns and spawning while processing needs no copy. spawning past it fails
+int diana_reserveAddressSpace(struct diana *diana, unsigned int entities);
+
+// align a component to a power of two, by default it is aligned to the largest power of
+// two dividing its size, up to what malloc aligns to. inline components are aligned in
+// their row and indexed ones in their slab
+int diana_componentAlignment(struct diana *diana, unsigned int component, size_t alignment);
+
+// hooks for components that can not be copied with memcpy, any can be NULL
+// - construct copies from, or makes a default one when from is NULL. an error it
+//   returns is passed on and the component is left out
+// - move constructs to from from and destroys from, inline rows move when the table grows
+// - checkpoints and deltas copy bytes and fail on worlds with such components
+int diana_componentLifecycle(
+	struct diana *diana,
+	unsigned int component,
+	int (*construct)(struct diana *, void *, void *data, const void *from),
+	void (*destruct)(struct diana *, void *, void *data),
+	void (*move)(struct diana *, void *, void *to, void *from),
+	void *userData
+);
+
 // ============================================================================
 // system
 int diana_createSystem(
@@ -96,6 +168,15 @@ int diana_watch(struct diana *diana, unsigned int system, unsigned int component
 
 int diana_exclude(struct diana *diana, unsigned int system, unsigned int component);
 
+// process the system's entities a batch of ids at a time instead of a call per entity
+// - replaces the process callback, batches hold up to DL_BATCH_SIZE ids in increasing order
+// - like watch and exclude, only before diana_initialize
+#ifndef DL_BATCH_SIZE
+#define DL_BATCH_SIZE 256
+#endif
+
+int diana_systemBatch(struct diana *diana, unsigned int system, void (*batch)(struct diana *, void *, const unsigned int *entities, unsigned int count, float delta));
+
 // ============================================================================
 // manager
 int diana_createManager(
@@ -116,6 +197,29 @@ int diana_process(struct diana *, float delta);
 
 int diana_processSystem(struct diana *, unsigned int system, float delta);
 
+// tables only grow on their own. reserve sizes the entity table, or the slots of an
+// indexed component, ahead of time. shrink gives back what is past the entities and
+// slots in use, and with autoShrink diana_process shrinks whenever capacity is over
+// factor times what is used, 0 turns it off
+int diana_reserve(struct diana *diana, unsigned int entities);
+
+int diana_reserveComponent(struct diana *diana, unsigned int component, unsigned int count);
+
+int diana_shrink(struct diana *diana);
+
+int diana_autoShrink(struct diana *diana, unsigned int factor);
+
+// move slots of indexed and multiple components so they are in entity order with the
+// free ones at the end, a little at a time: budget is about how many rows and slots
+// to look at, called once a frame a pass finishes after a few. slot pointers go stale
+int diana_defragment(struct diana *diana, unsigned int budget);
+
+// move the last live entities into the free ids below them so ids are a dense prefix
+// and systems stop walking holes. every move is passed to remap, anything holding
+// entity ids has to follow. not while processing, and under DL_DELTA only right
+// after a delta was made: a world mirroring this one compacts at the same point
+int diana_compact(struct diana *diana, void (*remap)(struct diana *, void *, unsigned int oldEntity, unsigned int newEntity), void *userData);
+
 // ============================================================================
 // entity
 int diana_spawn(struct diana *diana, unsigned int * entity_ptr);
@@ -129,7 +233,7 @@ int diana_setComponent(struct diana *diana, unsigned int entity, unsigned int co
 
 int diana_getComponent(struct diana *diana, unsigned int entity, unsigned int component, void ** data_ptr);
 
-#if DL_COMPUTE
+#if DL_COMPUTE || DL_DELTA
 int diana_dirtyComponent(struct diana *diana, unsigned int entity, unsigned int component);
 #endif
 
@@ -142,6 +246,9 @@ int diana_appendComponent(struct diana *diana, unsigned int entity, unsigned int
 
 int diana_removeComponents(struct diana *diana, unsigned int entity, unsigned int component);
 
+// room for a new component, appended for multiple ones, that the caller constructs in place
+int diana_emplaceComponent(struct diana *diana, unsigned int entity, unsigned int component, void ** data_ptr);
+
 // low level
 int diana_setComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i, const void * data);
 
@@ -149,6 +256,286 @@ int diana_getComponentI(struct diana *diana, unsigned int entity, unsigned int c
 
 int diana_removeComponentI(struct diana *diana, unsigned int entity, unsigned int component, unsigned int i);
 
+#if DL_HANDLES
+// handles: the entity in the low 32 bits and the generation of its row in the high
+// ones. the generation moves on when a deleted entity's id is freed, so a handle
+// stops resolving before the id is handed out again. the H calls take a handle and
+// fail with DL_ERROR_INVALID_VALUE when it is stale
+int diana_getHandle(struct diana *diana, unsigned int entity, unsigned long long * handle_ptr);
+
+int diana_resolveHandle(struct diana *diana, unsigned long long handle, unsigned int * entity_ptr);
+
+int diana_signalH(struct diana *diana, unsigned long long handle, unsigned int signal);
+
+int diana_setComponentH(struct diana *diana, unsigned long long handle, unsigned int component, const void * data);
+
+int diana_getComponentH(struct diana *diana, unsigned long long handle, unsigned int component, void ** data_ptr);
+
+int diana_removeComponentH(struct diana *diana, unsigned long long handle, unsigned int component);
+#endif
+
+// ============================================================================
+// storage
+// - the raw layout, for iterating without a call per component (World::each)
+// - valid until the next spawn, clone, component added or removed, or process
+#define DL_SIGNATURE_BITS (sizeof(unsigned int) * 8)
+
+struct diana_storage {
+	// row of entity e is at rows + e * rowSize
+	unsigned char *rows;
+	size_t rowSize;
+	unsigned int numRows;
+
+	// entity e has component c if bit c % DL_SIGNATURE_BITS of
+	// signatures[e * signatureWords + c / DL_SIGNATURE_BITS] is set
+	const unsigned int *signatures;
+	unsigned int signatureWords;
+
+	// a bit per entity that is added and enabled
+	const unsigned char *active;
+	unsigned int activeCapacity;
+};
+
+struct diana_componentStorage {
+	size_t size;
+	unsigned int flags;
+
+	// inline components are at row + offset, indexed ones at slots[*(unsigned int *)(row + offset)]
+	size_t offset;
+	void **slots;
+
+	// multiple and computed components have to go through diana_getComponent
+	int direct;
+};
+
+int diana_getStorage(struct diana *diana, struct diana_storage * storage);
+
+int diana_getComponentStorage(struct diana *diana, unsigned int component, struct diana_componentStorage * storage);
+
+#if DL_STATS
+// ============================================================================
+// stats
+// - times are in nanoseconds
+// - everything adds up until diana_resetStats
+// - DL_PERF counters come from perf_event_open on linux and follow the thread
+//   that first processes the world
+struct diana_stats {
+	unsigned int frames;
+	unsigned long long processTime;
+	unsigned long long bookkeepingTime;
+
+	// signals handled during book keeping
+	unsigned int added;
+	unsigned int enabled;
+	unsigned int disabled;
+	unsigned int deleted;
+
+	// system watch/exclude checks
+	unsigned int checks;
+
+	// calls made to the malloc and free diana was allocated with
+	unsigned int allocations;
+	unsigned int frees;
+
+#if DL_PERF
+	// DL_PERF_* bits of the hardware counters that could be opened
+	unsigned int perfCounters;
+#endif
+};
+
+struct diana_systemStats {
+	unsigned long long startingTime;
+	unsigned long long processTime;
+	unsigned long long endingTime;
+
+	unsigned int entities;
+	unsigned int subscribed;
+	unsigned int unsubscribed;
+
+#if DL_PERF
+	// hardware counters over the process loop, 0 when not available
+	unsigned long long cycles;
+	unsigned long long instructions;
+	unsigned long long cacheMisses;
+	unsigned long long branchMisses;
+#endif
+};
+
+#if DL_PERF
+#define DL_PERF_CYCLES        1
+#define DL_PERF_INSTRUCTIONS  2
+#define DL_PERF_CACHE_MISSES  4
+#define DL_PERF_BRANCH_MISSES 8
+#endif
+
+int diana_getStats(struct diana *diana, struct diana_stats * stats);
+
+int diana_getSystemStats(struct diana *diana, unsigned int system, struct diana_systemStats * stats);
+
+int diana_resetStats(struct diana *diana);
+#endif
+
+#if DL_TRACE
+// ============================================================================
+// trace
+// - records the last capacity spans of diana_process into a ring, capacity is
+//   rounded up to a power of two and can not be over 2^31
+// - id becomes the thread id in the trace, so several worlds can share a file
+int diana_traceStart(struct diana *diana, unsigned int capacity, unsigned int id);
+
+int diana_traceStop(struct diana *diana);
+
+int diana_traceDump(struct diana *diana, const char *filename);
+#endif
+
+// ============================================================================
+// memory
+// - sizes are in bytes, everything else counts entities or slots
+struct diana_memoryStats {
+	size_t total;
+
+	// entity table, rows in use, holes left by deleted entities and rows allocated
+	size_t entityTable;
+	unsigned int entityWidth;
+	unsigned int entityHeight;
+	unsigned int entityCapacity;
+	unsigned int freeEntities;
+	size_t processingData;
+
+	// a bit per component of every row, packed apart from the table
+	size_t signatures;
+
+	size_t freeEntityIds;
+	size_t signals;
+	size_t active;
+	size_t delta;
+
+	size_t components;
+	size_t systems;
+	size_t managers;
+};
+
+struct diana_componentMemoryStats {
+	size_t total;
+
+	// out of row storage for indexed and multiple components
+	size_t slots;
+	unsigned int slotCapacity;
+	unsigned int freeSlots;
+	size_t freeSlotIds;
+	size_t bags;
+
+	size_t compute;
+	size_t delta;
+};
+
+struct diana_systemMemoryStats {
+	size_t total;
+	size_t entities;
+	size_t watches;
+};
+
+int diana_getMemoryStats(struct diana *diana, struct diana_memoryStats * stats);
+
+int diana_getComponentMemoryStats(struct diana *diana, unsigned int component, struct diana_componentMemoryStats * stats);
+
+int diana_getSystemMemoryStats(struct diana *diana, unsigned int system, struct diana_systemMemoryStats * stats);
+
+// ============================================================================
+// checkpoint
+struct diana_checkpoint;
+
+int diana_checkpoint(struct diana *diana, struct diana_checkpoint ** checkpoint_ptr);
+
+int diana_rollback(struct diana *diana, struct diana_checkpoint * checkpoint);
+
+int diana_freeCheckpoint(struct diana *diana, struct diana_checkpoint * checkpoint);
+
+#if DL_DELTA
+// ============================================================================
+// delta
+int diana_createDelta(struct diana *diana, void ** delta_ptr, size_t * size_ptr);
+
+int diana_applyDelta(struct diana *diana, const void * delta, size_t size);
+
+int diana_freeDelta(struct diana *diana, void * delta);
+#endif
+
+#if DL_RECORD
+// ============================================================================
+// record
+// - logs every call made on the world to a file, tests/replay.c plays it back
+// - start before creating any component, recording ends with diana_free
+int diana_recordStart(struct diana *diana, const char *filename);
+
+int diana_recordStop(struct diana *diana);
+
+// the file starts with "DLR1" followed by records, an op and its arguments.
+// integers are LEB128, floats 4 raw bytes, names a length and the bytes, and
+// component data a byte telling if it is there and then the component's size
+// of bytes. calls made from callbacks come between a DL_RECORD_ENTER naming
+// the callback and a DL_RECORD_LEAVE, callbacks making no calls are left out.
+enum {
+	DL_RECORD_FREE,
+	DL_RECORD_INITIALIZE,
+	DL_RECORD_CREATE_COMPONENT,    // name, size, flags, component
+	DL_RECORD_COMPONENT_COMPUTE,   // component, has compute
+	DL_RECORD_CREATE_SYSTEM,       // name, flags, DL_RECORD_* bits of the callbacks given, system
+	DL_RECORD_WATCH,               // system, component
+	DL_RECORD_EXCLUDE,             // system, component
+	DL_RECORD_CREATE_MANAGER,      // name, flags, DL_RECORD_* bits of the callbacks given, manager
+	DL_RECORD_PROCESS,             // delta
+	DL_RECORD_PROCESS_SYSTEM,      // system, delta
+	DL_RECORD_SPAWN,               // entity
+	DL_RECORD_CLONE,               // parent, entity
+	DL_RECORD_SIGNAL,              // entity, signal
+	DL_RECORD_SET_COMPONENT,       // entity, component, data
+	DL_RECORD_GET_COMPONENT,       // entity, component
+	DL_RECORD_DIRTY_COMPONENT,     // entity, component
+	DL_RECORD_REMOVE_COMPONENT,    // entity, component
+	DL_RECORD_GET_COMPONENT_COUNT, // entity, component
+	DL_RECORD_APPEND_COMPONENT,    // entity, component, data
+	DL_RECORD_REMOVE_COMPONENTS,   // entity, component
+	DL_RECORD_SET_COMPONENT_I,     // entity, component, i, data
+	DL_RECORD_GET_COMPONENT_I,     // entity, component, i
+	DL_RECORD_REMOVE_COMPONENT_I,  // entity, component, i
+	DL_RECORD_CHECKPOINT,          // checkpoint
+	DL_RECORD_ROLLBACK,            // checkpoint
+	DL_RECORD_FREE_CHECKPOINT,     // checkpoint
+	DL_RECORD_CREATE_DELTA,
+	DL_RECORD_APPLY_DELTA,         // size, bytes
+	DL_RECORD_ENTER,               // callback, system/manager/component, entity
+	DL_RECORD_LEAVE,
+	DL_RECORD_SYSTEM_BATCH,        // system, has batch
+	DL_RECORD_COMPONENT_LIFECYCLE, // component, bits of the hooks given
+	DL_RECORD_EMPLACE_COMPONENT,   // entity, component
+	DL_RECORD_COMPONENT_ALIGNMENT, // component, alignment
+	DL_RECORD_RESERVE_ADDRESS_SPACE, // entities
+	DL_RECORD_RESERVE,             // entities
+	DL_RECORD_RESERVE_COMPONENT,   // component, count
+	DL_RECORD_SHRINK,
+	DL_RECORD_AUTO_SHRINK,         // factor
+	DL_RECORD_DEFRAGMENT,          // budget
+	DL_RECORD_COMPACT,
+	DL_RECORD_NUM_OPS
+};
+
+// callbacks
+enum {
+	DL_RECORD_STARTING,
+	DL_RECORD_PROCESS_ENTITY,
+	DL_RECORD_ENDING,
+	DL_RECORD_SUBSCRIBED,
+	DL_RECORD_UNSUBSCRIBED,
+	DL_RECORD_ADDED,
+	DL_RECORD_ENABLED,
+	DL_RECORD_DISABLED,
+	DL_RECORD_DELETED,
+	DL_RECORD_COMPUTE,
+	DL_RECORD_PROCESS_BATCH        // the entity is the first of the batch
+};
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,146 @@
+#include "../diana.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+// a warmed up world with a stable number of entities must not allocate
+// usage: DianaAllocations [entities] [frames]
+
+size_t allocations = 0, frees = 0;
+
+void *counting_malloc(size_t size) {
+    allocations++;
+    return malloc(size);
+}
+
+void counting_free(void *ptr) {
+    frees++;
+    free(ptr);
+}
+
+#define CHECK(X) do { int ___err = (X); if(___err != DL_ERROR_NONE) { fprintf(stderr, "%s:%i %s -> %i\n", __FILE__, __LINE__, #X, ___err); exit(1); } } while(0)
+
+struct position {
+    float x, y;
+};
+
+struct velocity {
+    float x, y;
+};
+
+struct health {
+    int points;
+};
+
+unsigned int positionComponent, velocityComponent, tagComponent, healthComponent;
+unsigned int seed = 1;
+
+unsigned int next_random(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+unsigned int spawn(struct diana *diana) {
+    struct position p = { 0, 0 };
+    struct velocity v = { 1, 2 };
+    struct health h = { 100 };
+    unsigned int eid;
+    CHECK(diana_spawn(diana, &eid));
+    CHECK(diana_appendComponent(diana, eid, positionComponent, &p));
+    CHECK(diana_appendComponent(diana, eid, velocityComponent, &v));
+    CHECK(diana_appendComponent(diana, eid, velocityComponent, &v));
+    CHECK(diana_appendComponent(diana, eid, tagComponent, NULL));
+    CHECK(diana_setComponent(diana, eid, healthComponent, &h));
+    CHECK(diana_signal(diana, eid, DL_ENTITY_ADDED));
+    return eid;
+}
+
+// every frame a few entities are replaced from inside a system
+unsigned int replace = 0;
+
+void move(struct diana *diana, void *user_data, unsigned int entity, float delta) {
+    struct position *p;
+    struct velocity *v;
+    unsigned int count, i;
+    diana_getComponent(diana, entity, positionComponent, (void **)&p);
+    diana_getComponentCount(diana, entity, velocityComponent, &count);
+    for(i = 0; i < count; i++) {
+        diana_getComponentI(diana, entity, velocityComponent, i, (void **)&v);
+        p->x += v->x * delta;
+        p->y += v->y * delta;
+    }
+    if(replace && next_random() % 16 == 0) {
+        replace--;
+        diana_signal(diana, entity, DL_ENTITY_DELETED);
+        spawn(diana);
+    }
+}
+
+void toggle(struct diana *diana, void *user_data, unsigned int entity, float delta) {
+    if(next_random() % 32 == 0) {
+        diana_signal(diana, entity, DL_ENTITY_DISABLED);
+        diana_signal(diana, entity, DL_ENTITY_ENABLED);
+    }
+}
+
+void frame(struct diana *diana, unsigned int entities) {
+    replace = entities / 50 + 1;
+    CHECK(diana_process(diana, 1.0f / 60.0f));
+}
+
+int main(int argc, char *argv[]) {
+    struct diana *diana;
+    unsigned int entities = argc > 1 ? atoi(argv[1]) : 10000;
+    unsigned int frames = argc > 2 ? atoi(argv[2]) : 100;
+    unsigned int i, system;
+    size_t before, steady;
+
+    CHECK(allocate_diana(counting_malloc, counting_free, &diana));
+    CHECK(diana_createComponent(diana, "position", sizeof(struct position), DL_COMPONENT_FLAG_INLINE, &positionComponent));
+    CHECK(diana_createComponent(diana, "velocity", sizeof(struct velocity), DL_COMPONENT_FLAG_MULTIPLE, &velocityComponent));
+    CHECK(diana_createComponent(diana, "tag", sizeof(unsigned int), DL_COMPONENT_FLAG_INDEXED, &tagComponent));
+    // every entity has it, so it stays in the row, but diana_process keeps looking
+    CHECK(diana_createComponent(diana, "health", sizeof(struct health), DL_COMPONENT_FLAG_INLINE | DL_COMPONENT_FLAG_ADAPTIVE, &healthComponent));
+
+    // toggle runs first, enabling an entity after move deleted it would undelete it
+    CHECK(diana_createSystem(diana, "toggle", NULL, toggle, NULL, NULL, NULL, NULL, DL_SYSTEM_FLAG_NORMAL, &system));
+    CHECK(diana_watch(diana, system, tagComponent));
+
+    CHECK(diana_createSystem(diana, "move", NULL, move, NULL, NULL, NULL, NULL, DL_SYSTEM_FLAG_NORMAL, &system));
+    CHECK(diana_watch(diana, system, positionComponent));
+    CHECK(diana_watch(diana, system, velocityComponent));
+
+    CHECK(diana_initialize(diana));
+
+    // sets only get pages and room where ids show up, replacements push ids and
+    // slots a little past the starting population
+    CHECK(diana_reserve(diana, entities * 2));
+    CHECK(diana_reserveComponent(diana, velocityComponent, entities * 4));
+    CHECK(diana_reserveComponent(diana, tagComponent, entities * 2));
+
+    for(i = 0; i < entities; i++) {
+        spawn(diana);
+    }
+
+    // warm up, every pool and set grows to its high water mark
+    for(i = 0; i < frames; i++) {
+        frame(diana, entities);
+    }
+
+    before = allocations;
+    for(i = 0; i < frames; i++) {
+        frame(diana, entities);
+    }
+
+    steady = allocations - before;
+    printf("%zu allocations in %u frames of %u entities\n", steady, frames, entities);
+
+    CHECK(diana_free(diana));
+
+    if(allocations != frees) {
+        printf("%zu allocations, %zu frees\n", allocations, frees);
+        return 1;
+    }
+
+    return steady != 0;
+}
@@ -0,0 +1,335 @@
+#include "../diana.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// usage: DianaBench [filter] [max entities]
+// prints one JSON object per line:
+// {"bench":"...","entities":N,"runs":R,"ops":O,"min_ns":...,"median_ns":...,"ns_per_op":...}
+
+#define RUNS 7
+
+struct position {
+    float x, y;
+};
+
+struct velocity {
+    float x, y;
+};
+
+struct bench {
+    const char *name;
+    void (*setup)(unsigned int entities);
+    // returns the number of operations done
+    unsigned int (*run)(unsigned int entities);
+    void (*teardown)(void);
+};
+
+static struct diana *diana;
+static unsigned int positionComponent, velocityComponent, hashComponent;
+static unsigned int mainSystem;
+static unsigned int processed;
+
+static unsigned int seed;
+
+static unsigned int next_random(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+static unsigned long long now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define CHECK(X) do { int ___err = (X); if(___err != DL_ERROR_NONE) { fprintf(stderr, "%s:%i %s -> %i\n", __FILE__, __LINE__, #X, ___err); exit(1); } } while(0)
+
+static void world(unsigned int positionFlags, unsigned int velocityFlags, void (*process)(struct diana *, void *, unsigned int, float)) {
+    seed = 1;
+    CHECK(allocate_diana(malloc, free, &diana));
+    CHECK(diana_createComponent(diana, "position", sizeof(struct position), positionFlags, &positionComponent));
+    CHECK(diana_createComponent(diana, "velocity", sizeof(struct velocity), velocityFlags, &velocityComponent));
+    CHECK(diana_createSystem(diana, "main", NULL, process, NULL, NULL, NULL, NULL, DL_SYSTEM_FLAG_NORMAL, &mainSystem));
+    CHECK(diana_watch(diana, mainSystem, positionComponent));
+    CHECK(diana_watch(diana, mainSystem, velocityComponent));
+}
+
+static unsigned int spawn_mover(void) {
+    struct position p = { 0, 0 };
+    struct velocity v = { 1, 2 };
+    unsigned int eid;
+    CHECK(diana_spawn(diana, &eid));
+    CHECK(diana_appendComponent(diana, eid, positionComponent, &p));
+    CHECK(diana_appendComponent(diana, eid, velocityComponent, &v));
+    CHECK(diana_signal(diana, eid, DL_ENTITY_ADDED));
+    return eid;
+}
+
+static void spawn_movers(unsigned int entities) {
+    unsigned int i;
+    CHECK(diana_initialize(diana));
+    for(i = 0; i < entities; i++) {
+        spawn_mover();
+    }
+    CHECK(diana_process(diana, 0));
+}
+
+static void free_world(void) {
+    diana_free(diana);
+    diana = NULL;
+}
+
+// ============================================================================
+// iteration over inline, indexed and multiple components
+static void move_process(struct diana *diana, void *user_data, unsigned int entity, float delta) {
+    struct position *p;
+    struct velocity *v;
+    diana_getComponent(diana, entity, positionComponent, (void **)&p);
+    diana_getComponent(diana, entity, velocityComponent, (void **)&v);
+    p->x += v->x * delta;
+    p->y += v->y * delta;
+    processed++;
+}
+
+static void move_multiple_process(struct diana *diana, void *user_data, unsigned int entity, float delta) {
+    struct position *p;
+    struct velocity *v;
+    unsigned int count, i;
+    diana_getComponent(diana, entity, positionComponent, (void **)&p);
+    diana_getComponentCount(diana, entity, velocityComponent, &count);
+    for(i = 0; i < count; i++) {
+        diana_getComponentI(diana, entity, velocityComponent, i, (void **)&v);
+        p->x += v->x * delta;
+        p->y += v->y * delta;
+    }
+    processed++;
+}
+
+static void setup_inline(unsigned int entities) {
+    world(DL_COMPONENT_FLAG_INLINE, DL_COMPONENT_FLAG_INLINE, move_process);
+    spawn_movers(entities);
+}
+
+static void setup_indexed(unsigned int entities) {
+    world(DL_COMPONENT_FLAG_INDEXED, DL_COMPONENT_FLAG_INDEXED, move_process);
+    spawn_movers(entities);
+}
+
+static void setup_multiple(unsigned int entities) {
+    unsigned int i;
+    struct velocity v = { 3, 4 };
+    world(DL_COMPONENT_FLAG_INLINE, DL_COMPONENT_FLAG_MULTIPLE, move_multiple_process);
+    spawn_movers(entities);
+    for(i = 0; i < entities; i++) {
+        CHECK(diana_appendComponent(diana, i, velocityComponent, &v));
+    }
+}
+
+static unsigned int run_process(unsigned int entities) {
+    processed = 0;
+    CHECK(diana_process(diana, 1.0f / 60.0f));
+    return processed;
+}
+
+// ============================================================================
+// spawn and delete churn, a tenth of the world replaced every frame
+static void nop_process(struct diana *diana, void *user_data, unsigned int entity, float delta) {
+    processed++;
+}
+
+static void setup_churn(unsigned int entities) {
+    world(DL_COMPONENT_FLAG_INLINE, DL_COMPONENT_FLAG_INDEXED, nop_process);
+    spawn_movers(entities);
+}
+
+static unsigned int run_churn(unsigned int entities) {
+    unsigned int n = entities / 10 + 1, i;
+    for(i = 0; i < n; i++) {
+        CHECK(diana_signal(diana, next_random() % entities, DL_ENTITY_DELETED));
+    }
+    CHECK(diana_process(diana, 0));
+    for(i = 0; i < n; i++) {
+        spawn_mover();
+    }
+    CHECK(diana_process(diana, 0));
+    return n;
+}
+
+// ============================================================================
+// diana_clone of an entity with inline, indexed and multiple components
+static unsigned int clones[1 << 20];
+
+static void setup_clone(unsigned int entities) {
+    struct velocity v = { 3, 4 };
+    world(DL_COMPONENT_FLAG_INLINE, DL_COMPONENT_FLAG_MULTIPLE, nop_process);
+    spawn_movers(1);
+    CHECK(diana_appendComponent(diana, 0, velocityComponent, &v));
+}
+
+static unsigned int run_clone(unsigned int entities) {
+    unsigned int i, n = entities < (sizeof(clones) / sizeof(clones[0])) ? entities : (sizeof(clones) / sizeof(clones[0]));
+    for(i = 0; i < n; i++) {
+        CHECK(diana_clone(diana, 0, &clones[i]));
+        CHECK(diana_signal(diana, clones[i], DL_ENTITY_ADDED));
+    }
+    CHECK(diana_process(diana, 0));
+    for(i = 0; i < n; i++) {
+        CHECK(diana_signal(diana, clones[i], DL_ENTITY_DELETED));
+    }
+    CHECK(diana_process(diana, 0));
+    return n;
+}
+
+// ============================================================================
+// disable and enable everything, every enable runs _check for every system
+#define MASS_SYSTEMS 8
+
+static void setup_mass_enable(unsigned int entities) {
+    unsigned int i, system;
+    world(DL_COMPONENT_FLAG_INLINE, DL_COMPONENT_FLAG_INLINE, nop_process);
+    for(i = 0; i < MASS_SYSTEMS; i++) {
+        CHECK(diana_createSystem(diana, "passive", NULL, nop_process, NULL, NULL, NULL, NULL, DL_SYSTEM_FLAG_PASSIVE, &system));
+        CHECK(diana_watch(diana, system, i & 1 ? positionComponent : velocityComponent));
+        if(i & 2) {
+            CHECK(diana_exclude(diana, system, i & 1 ? velocityComponent : positionComponent));
+        }
+    }
+    spawn_movers(entities);
+}
+
+static unsigned int run_mass_enable(unsigned int entities) {
+    unsigned int i;
+    for(i = 0; i < entities; i++) {
+        CHECK(diana_signal(diana, i, DL_ENTITY_DISABLED));
+    }
+    CHECK(diana_process(diana, 0));
+    for(i = 0; i < entities; i++) {
+        CHECK(diana_signal(diana, i, DL_ENTITY_ENABLED));
+    }
+    CHECK(diana_process(diana, 0));
+    return entities;
+}
+
+// ============================================================================
+// DL_COMPUTE lazy recompute, every entity dirtied and read once per frame
+#if DL_COMPUTE
+static void hash_compute(struct diana *diana, void *user_data, unsigned int entity, unsigned int i, void *data) {
+    struct position *p;
+    diana_getComponent(diana, entity, positionComponent, (void **)&p);
+    *(unsigned int *)data = (unsigned int)(p->x * 31 + p->y);
+}
+
+static void hash_process(struct diana *diana, void *user_data, unsigned int entity, float delta) {
+    unsigned int *hash;
+    diana_dirtyComponent(diana, entity, positionComponent);
+    diana_getComponent(diana, entity, hashComponent, (void **)&hash);
+    processed += *hash & 1;
+}
+
+static void setup_compute(unsigned int entities) {
+    unsigned int i;
+    world(DL_COMPONENT_FLAG_INLINE, DL_COMPONENT_FLAG_INLINE, hash_process);
+    CHECK(diana_createComponent(diana, "hash", sizeof(unsigned int), DL_COMPONENT_FLAG_INLINE, &hashComponent));
+    CHECK(diana_componentCompute(diana, hashComponent, hash_compute, NULL));
+    CHECK(diana_watch(diana, mainSystem, hashComponent));
+    CHECK(diana_initialize(diana));
+    for(i = 0; i < entities; i++) {
+        unsigned int eid = spawn_mover();
+        CHECK(diana_setComponent(diana, eid, hashComponent, NULL));
+    }
+    CHECK(diana_process(diana, 0));
+}
+
+static unsigned int run_compute(unsigned int entities) {
+    processed = 0;
+    CHECK(diana_process(diana, 0));
+    return entities;
+}
+#endif
+
+// ============================================================================
+// spawns from inside a system, these go through processingData
+static unsigned int spawner;
+
+static void spawn_process(struct diana *diana, void *user_data, unsigned int entity, float delta) {
+    unsigned int eid;
+    if(processed < sizeof(clones) / sizeof(clones[0]) && diana_spawn(diana, &eid) == DL_ERROR_NONE) {
+        diana_signal(diana, eid, DL_ENTITY_ADDED);
+        clones[processed++] = eid;
+    }
+}
+
+static void setup_spawn_mid_frame(unsigned int entities) {
+    world(DL_COMPONENT_FLAG_INLINE, DL_COMPONENT_FLAG_INLINE, nop_process);
+    CHECK(diana_createSystem(diana, "spawner", NULL, spawn_process, NULL, NULL, NULL, NULL, DL_SYSTEM_FLAG_PASSIVE, &spawner));
+    CHECK(diana_watch(diana, spawner, positionComponent));
+    spawn_movers(entities);
+}
+
+static unsigned int run_spawn_mid_frame(unsigned int entities) {
+    unsigned int i, spawns;
+    processed = 0;
+    CHECK(diana_processSystem(diana, spawner, 0));
+    spawns = processed;
+    // the new entities have no position, delete them again. the movers processed
+    // on the way count up processed too, they are not spawns
+    for(i = 0; i < spawns; i++) {
+        CHECK(diana_signal(diana, clones[i], DL_ENTITY_DELETED));
+    }
+    CHECK(diana_process(diana, 0));
+    return spawns;
+}
+
+// ============================================================================
+static struct bench benches[] = {
+    { "iterate_inline", setup_inline, run_process, free_world },
+    { "iterate_indexed", setup_indexed, run_process, free_world },
+    { "iterate_multiple", setup_multiple, run_process, free_world },
+    { "spawn_delete_churn", setup_churn, run_churn, free_world },
+    { "clone", setup_clone, run_clone, free_world },
+    { "mass_enable", setup_mass_enable, run_mass_enable, free_world },
+#if DL_COMPUTE
+    { "compute_recompute", setup_compute, run_compute, free_world },
+#endif
+    { "spawn_mid_frame", setup_spawn_mid_frame, run_spawn_mid_frame, free_world },
+};
+
+static int compare_ull(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]) {
+    static const unsigned int counts[] = { 1000, 10000, 100000, 1000000 };
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    unsigned int maxEntities = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : 100000;
+    unsigned long long times[RUNS], t;
+    unsigned int b, c, r, ops = 0;
+
+    for(b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        if(filter != NULL && strcmp(filter, "all") != 0 && strstr(benches[b].name, filter) == NULL) {
+            continue;
+        }
+        for(c = 0; c < sizeof(counts) / sizeof(counts[0]) && counts[c] <= maxEntities; c++) {
+            benches[b].setup(counts[c]);
+            // warm up, lets every table reach its working size
+            benches[b].run(counts[c]);
+            for(r = 0; r < RUNS; r++) {
+                t = now();
+                ops = benches[b].run(counts[c]);
+                times[r] = now() - t;
+            }
+            benches[b].teardown();
+
+            qsort(times, RUNS, sizeof(times[0]), compare_ull);
+            printf("{\"bench\":\"%s\",\"entities\":%u,\"runs\":%u,\"ops\":%u,\"min_ns\":%llu,\"median_ns\":%llu,\"ns_per_op\":%.2f}\n",
+                benches[b].name, counts[c], RUNS, ops, times[0], times[RUNS / 2], ops ? (double)times[RUNS / 2] / ops : 0.0);
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,294 @@
+#include "../diana.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// changes made on one world and sent over in deltas leave a second world the same,
+// and a rollback undoes everything since its checkpoint
+// usage: DianaDelta
+
+#if !DL_DELTA
+#error DianaDelta has to be built with DL_DELTA
+#endif
+
+#define CHECK(X) do { int ___err = (X); if(___err != DL_ERROR_NONE) { fprintf(stderr, "%s:%i %s -> %i\n", __FILE__, __LINE__, #X, ___err); exit(1); } } while(0)
+#define EXPECT(X) do { if(!(X)) { fprintf(stderr, "%s:%i %s\n", __FILE__, __LINE__, #X); exit(1); } } while(0)
+
+#define MAX_ENTITIES 64
+
+struct position {
+    float x, y;
+};
+
+struct velocity {
+    float x, y;
+};
+
+struct health {
+    int points;
+};
+
+// both worlds create these in the same order, so the ids match
+unsigned int positionComponent, tagComponent, velocityComponent, healthComponent;
+size_t sizes[4] = { sizeof(struct position), sizeof(unsigned int), sizeof(struct velocity), sizeof(struct health) };
+
+// allocations left before malloc starts failing, negative never fails
+int budget = -1;
+
+void *limited_malloc(size_t size) {
+    if(budget == 0) {
+        return NULL;
+    }
+    budget -= budget > 0;
+    return malloc(size);
+}
+
+// which entities the system walked in the last diana_process
+struct world {
+    struct diana *diana;
+    unsigned char visited[MAX_ENTITIES];
+};
+
+void visit(struct diana *diana, void *user_data, unsigned int entity, float delta) {
+    struct world *w = (struct world *)user_data;
+    w->visited[entity] = 1;
+}
+
+void create(struct world *w) {
+    unsigned int system;
+    memset(w, 0, sizeof(*w));
+    CHECK(allocate_diana(limited_malloc, free, &w->diana));
+    CHECK(diana_createComponent(w->diana, "position", sizeof(struct position), DL_COMPONENT_FLAG_INLINE, &positionComponent));
+    CHECK(diana_createComponent(w->diana, "tag", sizeof(unsigned int), DL_COMPONENT_FLAG_INDEXED, &tagComponent));
+    CHECK(diana_createComponent(w->diana, "velocity", sizeof(struct velocity), DL_COMPONENT_FLAG_MULTIPLE, &velocityComponent));
+    CHECK(diana_createComponent(w->diana, "health", sizeof(struct health), DL_COMPONENT_FLAG_INDEXED | DL_COMPONENT_FLAG_ADAPTIVE, &healthComponent));
+    CHECK(diana_createSystem(w->diana, "visit", NULL, visit, NULL, NULL, NULL, w, DL_SYSTEM_FLAG_NORMAL, &system));
+    CHECK(diana_watch(w->diana, system, positionComponent));
+    CHECK(diana_initialize(w->diana));
+}
+
+void process(struct world *w) {
+    memset(w->visited, 0, sizeof(w->visited));
+    CHECK(diana_process(w->diana, 1.0f / 60.0f));
+}
+
+unsigned int count(struct world *w, unsigned int entity, unsigned int component) {
+    unsigned int n;
+    if(diana_getComponentCount(w->diana, entity, component, &n) != DL_ERROR_NONE) {
+        return 0;
+    }
+    return n;
+}
+
+// every entity has the same components with the same data, and the system walked the same ones
+void compare(struct world *a, struct world *b) {
+    unsigned int entity, component, n, i;
+    void *pa, *pb;
+    for(entity = 0; entity < MAX_ENTITIES; entity++) {
+        EXPECT(a->visited[entity] == b->visited[entity]);
+        for(component = 0; component < 4; component++) {
+            n = count(a, entity, component);
+            EXPECT(count(b, entity, component) == n);
+            for(i = 0; i < n; i++) {
+                CHECK(diana_getComponentI(a->diana, entity, component, i, &pa));
+                CHECK(diana_getComponentI(b->diana, entity, component, i, &pb));
+                EXPECT(memcmp(pa, pb, sizes[component]) == 0);
+            }
+        }
+    }
+}
+
+// make a delta on a, apply it to b and process both
+void sync(struct world *a, struct world *b) {
+    void *delta;
+    size_t size;
+    CHECK(diana_createDelta(a->diana, &delta, &size));
+    CHECK(diana_applyDelta(b->diana, delta, size));
+    CHECK(diana_freeDelta(a->diana, delta));
+    process(a);
+    process(b);
+    compare(a, b);
+}
+
+unsigned int spawn(struct world *w, unsigned int i) {
+    struct position p = { (float)i, (float)i * 2 };
+    struct velocity v = { 1, (float)i };
+    unsigned int eid;
+    CHECK(diana_spawn(w->diana, &eid));
+    CHECK(diana_setComponent(w->diana, eid, positionComponent, &p));
+    if(i % 2 == 0) {
+        CHECK(diana_setComponent(w->diana, eid, tagComponent, &i));
+    }
+    CHECK(diana_appendComponent(w->diana, eid, velocityComponent, &v));
+    if(i % 3 == 0) {
+        CHECK(diana_appendComponent(w->diana, eid, velocityComponent, &v));
+    }
+    CHECK(diana_signal(w->diana, eid, DL_ENTITY_ADDED));
+    return eid;
+}
+
+void test_delta(void) {
+    struct world a, b;
+    struct position p = { -1, -1 };
+    struct velocity v = { 5, 5 };
+    unsigned int entities[16], tag = 99, eid, i;
+
+    create(&a);
+    create(&b);
+
+    // spawn
+    for(i = 0; i < 16; i++) {
+        entities[i] = spawn(&a, i);
+    }
+    sync(&a, &b);
+    EXPECT(b.visited[entities[15]]);
+
+    // change, inline, indexed and multiple
+    CHECK(diana_setComponent(a.diana, entities[1], positionComponent, &p));
+    CHECK(diana_setComponent(a.diana, entities[3], tagComponent, &tag));
+    CHECK(diana_setComponentI(a.diana, entities[6], velocityComponent, 1, &v));
+    CHECK(diana_appendComponent(a.diana, entities[2], velocityComponent, &v));
+    CHECK(diana_removeComponentI(a.diana, entities[0], velocityComponent, 0));
+    CHECK(diana_removeComponent(a.diana, entities[4], tagComponent));
+    sync(&a, &b);
+
+    // leaving the system, then the world
+    CHECK(diana_removeComponent(a.diana, entities[5], positionComponent));
+    CHECK(diana_signal(a.diana, entities[5], DL_ENTITY_ADDED));
+    CHECK(diana_signal(a.diana, entities[7], DL_ENTITY_DELETED));
+    CHECK(diana_signal(a.diana, entities[8], DL_ENTITY_DELETED));
+    sync(&a, &b);
+    EXPECT(!b.visited[entities[5]] && !b.visited[entities[7]]);
+
+    // the freed ids are handed out again on both sides
+    eid = spawn(&a, 16);
+    EXPECT(eid == entities[7] || eid == entities[8]);
+    sync(&a, &b);
+    EXPECT(b.visited[eid]);
+
+    CHECK(diana_free(a.diana));
+    CHECK(diana_free(b.diana));
+}
+
+void test_checkpoint(void) {
+    struct world a, b;
+    struct diana_checkpoint *checkpoint = NULL, *after = NULL;
+    struct diana_componentStorage storage;
+    struct position p = { -1, -1 };
+    struct health h = { 100 };
+    unsigned int entities[8], eid, i;
+
+    // b never sees what a does between checkpoint and rollback
+    create(&a);
+    create(&b);
+    for(i = 0; i < 8; i++) {
+        entities[i] = spawn(&a, i);
+        spawn(&b, i);
+    }
+    CHECK(diana_signal(a.diana, entities[7], DL_ENTITY_DELETED));
+    CHECK(diana_signal(b.diana, entities[7], DL_ENTITY_DELETED));
+    process(&a);
+    process(&b);
+
+    CHECK(diana_checkpoint(a.diana, &checkpoint));
+
+    CHECK(diana_setComponent(a.diana, entities[0], positionComponent, &p));
+    CHECK(diana_removeComponentI(a.diana, entities[1], velocityComponent, 0));
+    CHECK(diana_removeComponent(a.diana, entities[2], positionComponent));
+    CHECK(diana_signal(a.diana, entities[2], DL_ENTITY_ADDED));
+    CHECK(diana_signal(a.diana, entities[3], DL_ENTITY_DELETED));
+    eid = spawn(&a, 8);
+    EXPECT(eid == entities[7]);
+    process(&a);
+    EXPECT(!a.visited[entities[2]] && !a.visited[entities[3]]);
+
+    // values, system membership and free ids are back
+    CHECK(diana_rollback(a.diana, checkpoint));
+    process(&a);
+    process(&b);
+    compare(&a, &b);
+    CHECK(diana_spawn(a.diana, &eid));
+    EXPECT(eid == entities[7]);
+
+    // once every entity has health it moves into the row, checkpoints from before no longer fit
+    for(i = 0; i < 7; i++) {
+        CHECK(diana_setComponent(a.diana, entities[i], healthComponent, &h));
+    }
+    for(i = 0; i < 1000; i++) {
+        process(&a);
+        CHECK(diana_getComponentStorage(a.diana, healthComponent, &storage));
+        if(!(storage.flags & DL_COMPONENT_INDEXED_BIT)) {
+            break;
+        }
+    }
+    EXPECT(i < 1000);
+    EXPECT(diana_rollback(a.diana, checkpoint) == DL_ERROR_INVALID_VALUE);
+
+    CHECK(diana_checkpoint(a.diana, &after));
+    CHECK(diana_rollback(a.diana, after));
+
+    CHECK(diana_freeCheckpoint(a.diana, checkpoint));
+    CHECK(diana_freeCheckpoint(a.diana, after));
+    CHECK(diana_free(a.diana));
+    CHECK(diana_free(b.diana));
+}
+
+// a rollback that runs out of memory part way leaves the world as it was
+void test_rollbackOutOfMemory(void) {
+    struct world a, b;
+    struct diana_checkpoint *checkpoint = NULL;
+    unsigned int entities[32], i;
+    int fails, err;
+
+    for(fails = 0; ; fails++) {
+        create(&a);
+        create(&b);
+        for(i = 0; i < 32; i++) {
+            entities[i] = spawn(&a, i);
+            spawn(&b, i);
+        }
+        process(&a);
+        process(&b);
+        CHECK(diana_checkpoint(a.diana, &checkpoint));
+
+        // the table shrinks, so the rollback has to grow it again besides making bags
+        for(i = 4; i < 32; i++) {
+            CHECK(diana_signal(a.diana, entities[i], DL_ENTITY_DELETED));
+            CHECK(diana_signal(b.diana, entities[i], DL_ENTITY_DELETED));
+        }
+        process(&a);
+        process(&b);
+        CHECK(diana_shrink(a.diana));
+        CHECK(diana_shrink(b.diana));
+
+        budget = fails;
+        err = diana_rollback(a.diana, checkpoint);
+        budget = -1;
+        if(err == DL_ERROR_NONE) {
+            break;
+        }
+        EXPECT(err == DL_ERROR_OUT_OF_MEMORY);
+        process(&a);
+        process(&b);
+        compare(&a, &b);
+
+        CHECK(diana_freeCheckpoint(a.diana, checkpoint));
+        checkpoint = NULL;
+        CHECK(diana_free(a.diana));
+        CHECK(diana_free(b.diana));
+    }
+    EXPECT(fails > 0);
+
+    CHECK(diana_freeCheckpoint(a.diana, checkpoint));
+    CHECK(diana_free(a.diana));
+    CHECK(diana_free(b.diana));
+}
+
+int main(int argc, char *argv[]) {
+    test_delta();
+    test_checkpoint();
+    test_rollbackOutOfMemory();
+    printf("OK\n");
+    return 0;
+}
@@ -1,3 +1,8 @@
+// thresholds that always cross, the adaptive component moves every time it is looked at
+#define DL_ADAPTIVE_INLINE 0
+#define DL_ADAPTIVE_INDEXED 100
+#define DL_ADAPTIVE_FRAMES 256
+
 #include "../diana.c"
 
 #include <stdlib.h>
@@ -44,7 +49,7 @@ unsigned int component_indexed;
 unsigned int component_multiple;
 unsigned int component_indexed_limited;
 unsigned int component_multiple_limited;
-unsigned int components[5];
+unsigned int components[6];
 
 unsigned int random_system;
 
@@ -59,7 +64,7 @@ void BRK(void) { }
 #define R(MIN, MAX) ((rand() % (MAX - MIN)) + MIN)
 
 void add_random_component(unsigned int eid) {
-    DIANA(appendComponent, eid, R(0, 5), NULL);
+    DIANA(appendComponent, eid, R(0, 6), NULL);
 }
 
 unsigned int spawn(void) {
@@ -70,7 +75,7 @@ unsigned int spawn(void) {
     if(eid > max_eid_spawned) {
         max_eid_spawned = eid;
     }
-    for(action = 0; actions < actions; action++) {
+    for(action = 0; action < actions; action++) {
         add_random_component(eid);
     }
     return eid;
@@ -147,6 +152,13 @@ void random_process(struct diana *diana, void *ud, unsigned int eid, float delta
     }
 }
 
+void remap(struct diana *diana, void *ud, unsigned int old_eid, unsigned int new_eid) {
+    (void)ud;
+    if(_sparseIntegerSet_delete(diana, &disabled_eids, old_eid)) {
+        _sparseIntegerSet_insert(diana, &disabled_eids, new_eid);
+    }
+}
+
 struct timespec diff(struct timespec start, struct timespec end) {
     struct timespec temp;
     if((end.tv_nsec - start.tv_nsec) < 0) {
@@ -178,10 +190,12 @@ int main(int argc, char *argv[]) {
     DIANA(createComponent, "Multiple", 8, DL_COMPONENT_FLAG_MULTIPLE, &components[2]);
     DIANA(createComponent, "Indexed Limited", 256, DL_COMPONENT_FLAG_INDEXED | DL_COMPONENT_FLAG_LIMITED(128), &components[3]);
     DIANA(createComponent, "Multiple Limited", 256, DL_COMPONENT_FLAG_MULTIPLE | DL_COMPONENT_FLAG_LIMITED(128), &components[4]);
+    DIANA(createComponent, "Adaptive", 16, DL_COMPONENT_FLAG_INDEXED | DL_COMPONENT_FLAG_ADAPTIVE, &components[5]);
 
     DIANA(createSystem, "Random", NULL, random_process, NULL, random_subscribed, random_unsubscribed, NULL, DL_SYSTEM_FLAG_NORMAL, &random_system);
 
     DIANA(initialize);
+    DIANA(autoShrink, 2);
 
     for(i = 0; i < 128; i++) {
         add(spawn());
@@ -193,11 +207,15 @@ int main(int argc, char *argv[]) {
         if(!_sparseIntegerSet_isEmpty(global_diana, &disabled_eids)) {
             eid = _sparseIntegerSet_pop(global_diana, &disabled_eids);
             add_random_component(eid);
-            DIANA(removeComponents, eid, R(0, 5));
+            DIANA(removeComponents, eid, R(0, 6));
             enable(eid);
         }
 
         DIANA(process, 0);
+        DIANA(defragment, R(0, 64));
+        if(stati % 64 == 0) {
+            DIANA(compact, remap, NULL);
+        }
     }
 
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time3);
@@ -0,0 +1,141 @@
+#include "../diana.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+// a handle stops resolving once its entity is gone, whatever happens to the id after
+// usage: DianaHandles
+
+#if !DL_HANDLES
+#error DianaHandles has to be built with DL_HANDLES
+#endif
+
+#define CHECK(X) do { int ___err = (X); if(___err != DL_ERROR_NONE) { fprintf(stderr, "%s:%i %s -> %i\n", __FILE__, __LINE__, #X, ___err); exit(1); } } while(0)
+#define EXPECT(X) do { if(!(X)) { fprintf(stderr, "%s:%i %s\n", __FILE__, __LINE__, #X); exit(1); } } while(0)
+
+struct position {
+    float x, y;
+};
+
+unsigned int positionComponent;
+
+struct diana *create(void) {
+    struct diana *diana;
+    CHECK(allocate_diana(malloc, free, &diana));
+    CHECK(diana_createComponent(diana, "position", sizeof(struct position), DL_COMPONENT_FLAG_INLINE, &positionComponent));
+    CHECK(diana_initialize(diana));
+    return diana;
+}
+
+unsigned int spawn(struct diana *diana) {
+    struct position p = { 1, 2 };
+    unsigned int eid;
+    CHECK(diana_spawn(diana, &eid));
+    CHECK(diana_setComponent(diana, eid, positionComponent, &p));
+    CHECK(diana_signal(diana, eid, DL_ENTITY_ADDED));
+    return eid;
+}
+
+int stale(struct diana *diana, unsigned long long handle) {
+    unsigned int entity;
+    return diana_resolveHandle(diana, handle, &entity) == DL_ERROR_INVALID_VALUE;
+}
+
+void test_delete(void) {
+    struct diana *diana = create();
+    unsigned long long handle;
+    unsigned int eid, entity;
+    void *data;
+
+    eid = spawn(diana);
+    CHECK(diana_process(diana, 0));
+    CHECK(diana_getHandle(diana, eid, &handle));
+    CHECK(diana_resolveHandle(diana, handle, &entity));
+    EXPECT(entity == eid);
+
+    CHECK(diana_signalH(diana, handle, DL_ENTITY_DELETED));
+    CHECK(diana_process(diana, 0));
+    EXPECT(stale(diana, handle));
+    EXPECT(diana_getComponentH(diana, handle, positionComponent, &data) == DL_ERROR_INVALID_VALUE);
+
+    CHECK(diana_free(diana));
+}
+
+void test_respawn(void) {
+    struct diana *diana = create();
+    unsigned long long handle, fresh;
+    unsigned int eid;
+
+    eid = spawn(diana);
+    CHECK(diana_process(diana, 0));
+    CHECK(diana_getHandle(diana, eid, &handle));
+    CHECK(diana_signal(diana, eid, DL_ENTITY_DELETED));
+    CHECK(diana_process(diana, 0));
+
+    // the same id names another entity now
+    EXPECT(spawn(diana) == eid);
+    CHECK(diana_process(diana, 0));
+    EXPECT(stale(diana, handle));
+    EXPECT(diana_signalH(diana, handle, DL_ENTITY_DELETED) == DL_ERROR_INVALID_VALUE);
+    CHECK(diana_getHandle(diana, eid, &fresh));
+    EXPECT(fresh != handle && !stale(diana, fresh));
+
+    CHECK(diana_free(diana));
+}
+
+unsigned int moved[16];
+
+void remap(struct diana *diana, void *userData, unsigned int oldEntity, unsigned int newEntity) {
+    moved[oldEntity] = newEntity;
+}
+
+void test_compact(void) {
+    struct diana *diana = create();
+    unsigned long long handles[16], fresh;
+    unsigned int entities[16], i, entity;
+
+    for(i = 0; i < 16; i++) {
+        entities[i] = spawn(diana);
+    }
+    CHECK(diana_process(diana, 0));
+    for(i = 0; i < 16; i++) {
+        CHECK(diana_getHandle(diana, entities[i], &handles[i]));
+        moved[entities[i]] = entities[i];
+    }
+
+    // the low half goes, the high half moves down into its ids and the rest of the table is dropped
+    for(i = 0; i < 8; i++) {
+        CHECK(diana_signal(diana, entities[i], DL_ENTITY_DELETED));
+    }
+    CHECK(diana_process(diana, 0));
+    CHECK(diana_compact(diana, remap, NULL));
+    CHECK(diana_shrink(diana));
+
+    for(i = 0; i < 16; i++) {
+        EXPECT(stale(diana, handles[i]));
+    }
+    for(i = 8; i < 16; i++) {
+        CHECK(diana_getHandle(diana, moved[entities[i]], &fresh));
+        CHECK(diana_resolveHandle(diana, fresh, &entity));
+        EXPECT(entity == moved[entities[i]] && entity < 8);
+    }
+
+    // the dropped ids come back with a generation none of the old handles had
+    for(i = 0; i < 8; i++) {
+        spawn(diana);
+    }
+    CHECK(diana_process(diana, 0));
+    for(i = 0; i < 16; i++) {
+        EXPECT(stale(diana, handles[i]));
+    }
+
+    CHECK(diana_free(diana));
+}
+
+int main(int argc, char *argv[]) {
+    test_delete();
+    test_respawn();
+    test_compact();
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,629 @@
+// the record format is only declared when DL_RECORD is on, replaying does not need it in the library
+#define DL_RECORD 1
+#include "../diana.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// usage: DianaReplay file [runs]
+// plays a file written by diana_recordStart against a new world with callbacks
+// that do nothing but replay the calls recorded inside them. prints one JSON
+// object per op with a log2 histogram of its latency, then a summary.
+
+#define BUCKETS 40
+
+static const char *op_names[DL_RECORD_NUM_OPS] = {
+    "free", "initialize", "createComponent", "componentCompute", "createSystem", "watch", "exclude", "createManager",
+    "process", "processSystem", "spawn", "clone", "signal", "setComponent", "getComponent", "dirtyComponent",
+    "removeComponent", "getComponentCount", "appendComponent", "removeComponents", "setComponentI", "getComponentI",
+    "removeComponentI", "checkpoint", "rollback", "freeCheckpoint", "createDelta", "applyDelta", "enter", "leave", "systemBatch",
+    "componentLifecycle", "emplaceComponent", "componentAlignment",
+    "reserveAddressSpace", "reserve", "reserveComponent", "shrink", "autoShrink",
+    "defragment", "compact"
+};
+
+struct op_stats {
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long total_ns;
+    unsigned long long histogram[BUCKETS];
+};
+
+static struct op_stats stats[DL_RECORD_NUM_OPS];
+
+static const unsigned char *data;
+static size_t size, position;
+
+static struct diana *diana;
+static unsigned int ids[1024];
+static size_t component_sizes[1024];
+static unsigned int num_components;
+
+// recorded entity id -> replayed entity id
+static unsigned int *entities;
+static unsigned int num_entities;
+
+static struct diana_checkpoint **checkpoints;
+static unsigned int num_checkpoints;
+
+static unsigned long long divergences;
+
+static unsigned long long now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void truncated(void) {
+    fprintf(stderr, "record truncated at byte %zu\n", position);
+    exit(1);
+}
+
+static unsigned char read_byte(void) {
+    if(position >= size) {
+        truncated();
+    }
+    return data[position++];
+}
+
+static unsigned int read_uint(void) {
+    unsigned int value = 0, shift = 0;
+    unsigned char byte;
+    do {
+        byte = read_byte();
+        value |= (unsigned int)(byte & 0x7f) << shift;
+        shift += 7;
+    } while(byte & 0x80);
+    return value;
+}
+
+static float read_float(void) {
+    float value;
+    if(position + sizeof(value) > size) {
+        truncated();
+    }
+    memcpy(&value, data + position, sizeof(value));
+    position += sizeof(value);
+    return value;
+}
+
+static const void *read_bytes(size_t n) {
+    const void *ptr = data + position;
+    if(position + n > size) {
+        truncated();
+    }
+    position += n;
+    return ptr;
+}
+
+static char *read_name(void) {
+    unsigned int length = read_uint();
+    char *name = malloc(length + 1);
+    memcpy(name, read_bytes(length), length);
+    name[length] = 0;
+    return name;
+}
+
+static const void *read_data(unsigned int component) {
+    if(!read_byte()) {
+        return NULL;
+    }
+    return read_bytes(component < num_components ? component_sizes[component] : 0);
+}
+
+static unsigned int entity(unsigned int recorded) {
+    return recorded < num_entities && entities[recorded] != ~0u ? entities[recorded] : recorded;
+}
+
+static void map_entity(unsigned int recorded, unsigned int replayed) {
+    if(recorded >= num_entities) {
+        unsigned int n = (recorded + 1) * 2;
+        entities = realloc(entities, sizeof(*entities) * n);
+        memset(entities + num_entities, 0xff, sizeof(*entities) * (n - num_entities));
+        num_entities = n;
+    }
+    entities[recorded] = replayed;
+}
+
+static struct diana_checkpoint **checkpoint(unsigned int id) {
+    if(id >= num_checkpoints) {
+        unsigned int n = (id + 1) * 2;
+        checkpoints = realloc(checkpoints, sizeof(*checkpoints) * n);
+        memset(checkpoints + num_checkpoints, 0, sizeof(*checkpoints) * (n - num_checkpoints));
+        num_checkpoints = n;
+    }
+    return checkpoints + id;
+}
+
+static void free_checkpoints(void) {
+    unsigned int i;
+    for(i = 0; i < num_checkpoints; i++) {
+        diana_freeCheckpoint(diana, checkpoints[i]);
+    }
+    free(checkpoints);
+    checkpoints = NULL;
+    num_checkpoints = 0;
+}
+
+static void skip_block(void);
+static void run_until_leave(void);
+
+// ============================================================================
+// callbacks, each plays back the calls recorded inside it
+static void callback(unsigned int kind, unsigned int id, unsigned int e) {
+    size_t start = position;
+    if(position < size && data[position] == DL_RECORD_ENTER) {
+        position++;
+        if(read_uint() == kind && read_uint() == id && entity(read_uint()) == e) {
+            run_until_leave();
+            return;
+        }
+    }
+    position = start;
+}
+
+static void starting(struct diana *diana, void *ud) { callback(DL_RECORD_STARTING, *(unsigned int *)ud, 0); }
+static void process(struct diana *diana, void *ud, unsigned int e, float delta) { callback(DL_RECORD_PROCESS_ENTITY, *(unsigned int *)ud, e); }
+static void batch(struct diana *diana, void *ud, const unsigned int *e, unsigned int count, float delta) { callback(DL_RECORD_PROCESS_BATCH, *(unsigned int *)ud, e[0]); }
+static void ending(struct diana *diana, void *ud) { callback(DL_RECORD_ENDING, *(unsigned int *)ud, 0); }
+static void subscribed(struct diana *diana, void *ud, unsigned int e) { callback(DL_RECORD_SUBSCRIBED, *(unsigned int *)ud, e); }
+static void unsubscribed(struct diana *diana, void *ud, unsigned int e) { callback(DL_RECORD_UNSUBSCRIBED, *(unsigned int *)ud, e); }
+static void added(struct diana *diana, void *ud, unsigned int e) { callback(DL_RECORD_ADDED, *(unsigned int *)ud, e); }
+static void enabled(struct diana *diana, void *ud, unsigned int e) { callback(DL_RECORD_ENABLED, *(unsigned int *)ud, e); }
+static void disabled(struct diana *diana, void *ud, unsigned int e) { callback(DL_RECORD_DISABLED, *(unsigned int *)ud, e); }
+static void deleted(struct diana *diana, void *ud, unsigned int e) { callback(DL_RECORD_DELETED, *(unsigned int *)ud, e); }
+#if DL_COMPUTE
+static void compute(struct diana *diana, void *ud, unsigned int e, unsigned int i, void *d) { callback(DL_RECORD_COMPUTE, *(unsigned int *)ud, e); }
+#endif
+
+#define CB(B, F) ((mask & (1 << (B))) ? (F) : NULL)
+
+// ============================================================================
+// replay
+static void run(unsigned char op) {
+    unsigned int a, b, c, mask, flags;
+    const void *d;
+    void *ptr;
+    char *name;
+    int err = DL_ERROR_NONE;
+    unsigned long long t0 = 0;
+
+    if(op >= DL_RECORD_NUM_OPS) {
+        fprintf(stderr, "unknown op %u at byte %zu\n", op, position - 1);
+        exit(1);
+    }
+
+    // arguments are read before the clock starts
+    switch(op) {
+    case DL_RECORD_ENTER:
+        // a callback that did not happen in this replay
+        position--;
+        skip_block();
+        divergences++;
+        return;
+    case DL_RECORD_LEAVE:
+        return;
+    case DL_RECORD_FREE:
+        free_checkpoints();
+        t0 = now();
+        err = diana_free(diana);
+        diana = NULL;
+        break;
+    case DL_RECORD_INITIALIZE:
+        t0 = now();
+        err = diana_initialize(diana);
+        break;
+    case DL_RECORD_CREATE_COMPONENT:
+        name = read_name();
+        a = read_uint();
+        flags = read_uint();
+        read_uint();
+        t0 = now();
+        err = diana_createComponent(diana, name, a, flags, &c);
+        if(err == DL_ERROR_NONE && c < 1024) {
+            component_sizes[c] = a;
+            num_components = c + 1;
+        }
+        free(name);
+        break;
+    case DL_RECORD_COMPONENT_COMPUTE:
+        a = read_uint();
+        b = read_uint();
+        t0 = now();
+#if DL_COMPUTE
+        err = diana_componentCompute(diana, a, b ? compute : NULL, ids + (a & 1023));
+#endif
+        break;
+    case DL_RECORD_CREATE_SYSTEM:
+        name = read_name();
+        flags = read_uint();
+        mask = read_uint();
+        a = read_uint();
+        t0 = now();
+        err = diana_createSystem(diana, name, CB(DL_RECORD_STARTING, starting), CB(DL_RECORD_PROCESS_ENTITY, process), CB(DL_RECORD_ENDING, ending),
+                                 CB(DL_RECORD_SUBSCRIBED, subscribed), CB(DL_RECORD_UNSUBSCRIBED, unsubscribed), ids + (a & 1023), flags, &b);
+        free(name);
+        break;
+    case DL_RECORD_COMPONENT_LIFECYCLE:
+        // the recorded data is plain bytes here, so no hooks
+        a = read_uint();
+        read_uint();
+        t0 = now();
+        err = diana_componentLifecycle(diana, a, NULL, NULL, NULL, NULL);
+        break;
+    case DL_RECORD_RESERVE_ADDRESS_SPACE:
+        a = read_uint();
+        t0 = now();
+        err = diana_reserveAddressSpace(diana, a);
+        break;
+    case DL_RECORD_RESERVE:
+        a = read_uint();
+        t0 = now();
+        err = diana_reserve(diana, a);
+        break;
+    case DL_RECORD_RESERVE_COMPONENT:
+        a = read_uint();
+        b = read_uint();
+        t0 = now();
+        err = diana_reserveComponent(diana, a, b);
+        break;
+    case DL_RECORD_SHRINK:
+        t0 = now();
+        err = diana_shrink(diana);
+        break;
+    case DL_RECORD_AUTO_SHRINK:
+        a = read_uint();
+        t0 = now();
+        err = diana_autoShrink(diana, a);
+        break;
+    case DL_RECORD_DEFRAGMENT:
+        a = read_uint();
+        t0 = now();
+        err = diana_defragment(diana, a);
+        break;
+    case DL_RECORD_COMPACT:
+        t0 = now();
+        err = diana_compact(diana, NULL, NULL);
+        break;
+    case DL_RECORD_COMPONENT_ALIGNMENT:
+        a = read_uint();
+        b = read_uint();
+        t0 = now();
+        err = diana_componentAlignment(diana, a, b);
+        break;
+    case DL_RECORD_SYSTEM_BATCH:
+        a = read_uint();
+        b = read_uint();
+        t0 = now();
+        err = diana_systemBatch(diana, a, b ? batch : NULL);
+        break;
+    case DL_RECORD_WATCH:
+        a = read_uint();
+        b = read_uint();
+        t0 = now();
+        err = diana_watch(diana, a, b);
+        break;
+    case DL_RECORD_EXCLUDE:
+        a = read_uint();
+        b = read_uint();
+        t0 = now();
+        err = diana_exclude(diana, a, b);
+        break;
+    case DL_RECORD_CREATE_MANAGER:
+        name = read_name();
+        flags = read_uint();
+        mask = read_uint();
+        a = read_uint();
+        t0 = now();
+        err = diana_createManager(diana, name, CB(DL_RECORD_ADDED, added), CB(DL_RECORD_ENABLED, enabled), CB(DL_RECORD_DISABLED, disabled),
+                                  CB(DL_RECORD_DELETED, deleted), ids + (a & 1023), flags, &b);
+        free(name);
+        break;
+    case DL_RECORD_PROCESS: {
+        float delta = read_float();
+        t0 = now();
+        err = diana_process(diana, delta);
+        break;
+    }
+    case DL_RECORD_PROCESS_SYSTEM: {
+        float delta;
+        a = read_uint();
+        delta = read_float();
+        t0 = now();
+        err = diana_processSystem(diana, a, delta);
+        break;
+    }
+    case DL_RECORD_SPAWN:
+        a = read_uint();
+        t0 = now();
+        err = diana_spawn(diana, &b);
+        map_entity(a, b);
+        break;
+    case DL_RECORD_CLONE:
+        a = entity(read_uint());
+        b = read_uint();
+        t0 = now();
+        err = diana_clone(diana, a, &c);
+        map_entity(b, c);
+        break;
+    case DL_RECORD_SIGNAL:
+        a = entity(read_uint());
+        b = read_uint();
+        t0 = now();
+        err = diana_signal(diana, a, b);
+        break;
+    case DL_RECORD_SET_COMPONENT:
+        a = entity(read_uint());
+        b = read_uint();
+        d = read_data(b);
+        t0 = now();
+        err = diana_setComponent(diana, a, b, d);
+        break;
+    case DL_RECORD_GET_COMPONENT:
+        a = entity(read_uint());
+        b = read_uint();
+        t0 = now();
+        err = diana_getComponent(diana, a, b, &ptr);
+        break;
+    case DL_RECORD_DIRTY_COMPONENT:
+        a = entity(read_uint());
+        b = read_uint();
+        t0 = now();
+#if DL_COMPUTE || DL_DELTA
+        err = diana_dirtyComponent(diana, a, b);
+#endif
+        break;
+    case DL_RECORD_REMOVE_COMPONENT:
+        a = entity(read_uint());
+        b = read_uint();
+        t0 = now();
+        err = diana_removeComponent(diana, a, b);
+        break;
+    case DL_RECORD_GET_COMPONENT_COUNT:
+        a = entity(read_uint());
+        b = read_uint();
+        t0 = now();
+        err = diana_getComponentCount(diana, a, b, &c);
+        break;
+    case DL_RECORD_APPEND_COMPONENT:
+        a = entity(read_uint());
+        b = read_uint();
+        d = read_data(b);
+        t0 = now();
+        err = diana_appendComponent(diana, a, b, d);
+        break;
+    case DL_RECORD_EMPLACE_COMPONENT:
+        a = entity(read_uint());
+        b = read_uint();
+        t0 = now();
+        err = diana_emplaceComponent(diana, a, b, &ptr);
+        break;
+    case DL_RECORD_REMOVE_COMPONENTS:
+        a = entity(read_uint());
+        b = read_uint();
+        t0 = now();
+        err = diana_removeComponents(diana, a, b);
+        break;
+    case DL_RECORD_SET_COMPONENT_I:
+        a = entity(read_uint());
+        b = read_uint();
+        c = read_uint();
+        d = read_data(b);
+        t0 = now();
+        err = diana_setComponentI(diana, a, b, c, d);
+        break;
+    case DL_RECORD_GET_COMPONENT_I:
+        a = entity(read_uint());
+        b = read_uint();
+        c = read_uint();
+        t0 = now();
+        err = diana_getComponentI(diana, a, b, c, &ptr);
+        break;
+    case DL_RECORD_REMOVE_COMPONENT_I:
+        a = entity(read_uint());
+        b = read_uint();
+        c = read_uint();
+        t0 = now();
+        err = diana_removeComponentI(diana, a, b, c);
+        break;
+    case DL_RECORD_CHECKPOINT:
+        a = read_uint();
+        t0 = now();
+        err = diana_checkpoint(diana, checkpoint(a));
+        break;
+    case DL_RECORD_ROLLBACK:
+        a = read_uint();
+        t0 = now();
+        err = diana_rollback(diana, *checkpoint(a));
+        break;
+    case DL_RECORD_FREE_CHECKPOINT:
+        a = read_uint();
+        t0 = now();
+        err = diana_freeCheckpoint(diana, *checkpoint(a));
+        *checkpoint(a) = NULL;
+        break;
+    case DL_RECORD_CREATE_DELTA:
+        t0 = now();
+#if DL_DELTA
+        {
+            size_t n;
+            err = diana_createDelta(diana, &ptr, &n);
+            if(err == DL_ERROR_NONE) {
+                diana_freeDelta(diana, ptr);
+            }
+        }
+#endif
+        break;
+    case DL_RECORD_APPLY_DELTA:
+        a = read_uint();
+        d = read_bytes(a);
+        t0 = now();
+#if DL_DELTA
+        err = diana_applyDelta(diana, d, a);
+#endif
+        break;
+    }
+
+    {
+        unsigned long long ns = now() - t0;
+        unsigned int bucket = 0;
+        while(bucket < BUCKETS - 1 && (2ULL << bucket) <= ns) {
+            bucket++;
+        }
+        stats[op].calls++;
+        stats[op].errors += err != DL_ERROR_NONE;
+        stats[op].total_ns += ns;
+        stats[op].histogram[bucket]++;
+    }
+}
+
+static void run_until_leave(void) {
+    unsigned char op;
+    while((op = read_byte()) != DL_RECORD_LEAVE) {
+        run(op);
+    }
+}
+
+static void skip_args(unsigned char op) {
+    unsigned int a;
+    switch(op) {
+    case DL_RECORD_FREE: case DL_RECORD_INITIALIZE: case DL_RECORD_CREATE_DELTA: case DL_RECORD_LEAVE: case DL_RECORD_SHRINK: case DL_RECORD_COMPACT:
+        break;
+    case DL_RECORD_CREATE_COMPONENT:
+        free(read_name()); read_uint(); read_uint(); read_uint();
+        break;
+    case DL_RECORD_CREATE_SYSTEM: case DL_RECORD_CREATE_MANAGER:
+        free(read_name()); read_uint(); read_uint(); read_uint();
+        break;
+    case DL_RECORD_PROCESS:
+        read_float();
+        break;
+    case DL_RECORD_PROCESS_SYSTEM:
+        read_uint(); read_float();
+        break;
+    case DL_RECORD_SPAWN: case DL_RECORD_CHECKPOINT: case DL_RECORD_ROLLBACK: case DL_RECORD_FREE_CHECKPOINT:
+    case DL_RECORD_RESERVE_ADDRESS_SPACE: case DL_RECORD_RESERVE: case DL_RECORD_AUTO_SHRINK: case DL_RECORD_DEFRAGMENT:
+        read_uint();
+        break;
+    case DL_RECORD_SET_COMPONENT: case DL_RECORD_APPEND_COMPONENT:
+        read_uint(); read_data(read_uint());
+        break;
+    case DL_RECORD_SET_COMPONENT_I:
+        read_uint(); a = read_uint(); read_uint(); read_data(a);
+        break;
+    case DL_RECORD_GET_COMPONENT_I: case DL_RECORD_REMOVE_COMPONENT_I: case DL_RECORD_ENTER:
+        read_uint(); read_uint(); read_uint();
+        break;
+    case DL_RECORD_APPLY_DELTA:
+        read_bytes(read_uint());
+        break;
+    default:
+        read_uint(); read_uint();
+        break;
+    }
+}
+
+// skips an ENTER and everything up to its LEAVE
+static void skip_block(void) {
+    unsigned int depth = 0;
+    do {
+        unsigned char op = read_byte();
+        if(op >= DL_RECORD_NUM_OPS) {
+            fprintf(stderr, "unknown op %u at byte %zu\n", op, position - 1);
+            exit(1);
+        }
+        depth += op == DL_RECORD_ENTER;
+        depth -= op == DL_RECORD_LEAVE;
+        skip_args(op);
+    } while(depth);
+}
+
+static unsigned long long percentile(struct op_stats *s, double p) {
+    unsigned long long want = s->calls * p, seen = 0;
+    unsigned int bucket;
+    for(bucket = 0; bucket < BUCKETS; bucket++) {
+        seen += s->histogram[bucket];
+        if(seen > want) {
+            break;
+        }
+    }
+    // upper bound of the bucket
+    return 2ULL << bucket;
+}
+
+int main(int argc, char *argv[]) {
+    FILE *file;
+    unsigned int runs = argc > 2 ? atoi(argv[2]) : 1, r, i, b;
+    unsigned long long start, ns = 0, calls = 0;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s file [runs]\n", argv[0]);
+        return 1;
+    }
+
+    file = fopen(argv[1], "rb");
+    if(file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = malloc(size);
+    if(fread((void *)data, 1, size, file) != size || size < 4 || memcmp(data, "DLR1", 4) != 0) {
+        fprintf(stderr, "%s is not a diana record\n", argv[1]);
+        return 1;
+    }
+    fclose(file);
+
+    for(i = 0; i < 1024; i++) {
+        ids[i] = i;
+    }
+
+    for(r = 0; r < runs; r++) {
+        num_components = 0;
+        num_entities = 0;
+        num_checkpoints = 0;
+        if(allocate_diana(malloc, free, &diana) != DL_ERROR_NONE) {
+            return 1;
+        }
+
+        start = now();
+        position = 4;
+        while(position < size && diana != NULL) {
+            run(read_byte());
+        }
+        ns += now() - start;
+
+        // a record that was stopped early leaves the world alive
+        if(diana != NULL) {
+            free_checkpoints();
+            diana_free(diana);
+        }
+        free(entities);
+        entities = NULL;
+    }
+
+    for(i = 0; i < DL_RECORD_NUM_OPS; i++) {
+        struct op_stats *s = stats + i;
+        if(s->calls == 0) {
+            continue;
+        }
+        calls += s->calls;
+        printf("{\"op\":\"%s\",\"calls\":%llu,\"errors\":%llu,\"total_ns\":%llu,\"mean_ns\":%.2f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"histogram\":[",
+               op_names[i], s->calls, s->errors, s->total_ns, (double)s->total_ns / s->calls, percentile(s, 0.5), percentile(s, 0.99));
+        for(b = 0; b < BUCKETS; b++) {
+            printf(b ? ",%llu" : "%llu", s->histogram[b]);
+        }
+        printf("]}\n");
+    }
+
+    printf("{\"runs\":%u,\"calls\":%llu,\"ns\":%llu,\"calls_per_sec\":%.0f,\"divergences\":%llu}\n",
+           runs, calls, ns, ns ? (double)calls * 1e9 / ns : 0.0, divergences);
+
+    free((void *)data);
+
+    return 0;
+}